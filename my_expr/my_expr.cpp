@@ -1,4 +1,9 @@
 #include "my_expr.h"
+#include "my_expr_cache.h"
+#include "my_expr_simd.h"
+
+#include <charconv>
+#include <climits>
 
 #pragma region functions
 
@@ -6,34 +11,159 @@
 
 void expr::compile()
 {
+    auto result = this->try_compile();
+    if (!result)
+        std::cerr << "Error during compilation: " << result.error().message << std::endl;
+}
+
+expr_result<compiled_expr_ptr> expr::try_compile() noexcept
+{
+    // a failed compilation must not leave the previous program behind
+    this->compiled_ = empty_compiled();
+    this->context_ = eval_context();
     try
     {
         auto tokens = this->tokenize();
         if (tokens.empty())
-            return;
+            return this->compiled_;
         // this->print_tokens(tokens);
         auto outputQueue = this->shunting_yard(tokens);
         // this->print_tokens(outputQueue);
 
-        this->output_compiled_ = outputQueue;
+        auto root = this->build_ast(outputQueue);
+        this->simplify(root);
+        auto compiled = std::make_shared<compiled_expr>();
+        compiled->expression_ = this->expression_;
+        compiled->program_ = this->generate_program(*root);
+        if (this->jit_enabled_)
+            jit_compile(*compiled);
+
+        this->compiled_ = std::move(compiled);
+        this->context_ = eval_context(this->compiled_);
+        this->context_.set_unknown_var_resolver(this->unknown_var_resolver_);
+        this->context_.set_async_var_resolver(this->async_var_resolver_);
+        this->bind_slots();
+        return this->compiled_;
+    }
+    catch (const expr_exception &ex)
+    {
+        return expr_error{ex.code(), ex.position(), {}, ex.what()};
     }
     catch (const std::exception &ex)
     {
-        std::cerr << "Error during compilation: " << ex.what() << std::endl;
+        return expr_error{expr_errc::SYNTAX, expr_error::no_position, {}, ex.what()};
+    }
+}
+
+expr_dependencies compiled_expr::dependencies() const
+{
+    expr_dependencies dependencies;
+    dependencies.variables = this->program_.names;
+    for (const auto &name : this->program_.functions)
+    {
+        const bool builtin = m_parser_builtins::f.count(name) || f_parser_builtins::f.count(name);
+        (builtin ? dependencies.builtin_functions : dependencies.user_functions).push_back(name);
+    }
+    for (const auto &path : this->program_.json_paths)
+    {
+        dependencies.paths.push_back({this->program_.names[path.slot], path.keys, path.dynamic});
+        dependencies.dynamic_access |= path.dynamic;
+    }
+    return dependencies;
+}
+
+string_t expr_dependencies::path_t::to_string() const
+{
+    string_t text = this->variable;
+    for (const auto &key : this->keys)
+    {
+        if (const num_t *index = std::get_if<num_t>(&key))
+        {
+            // indexes are truncated like INDEX does, the ones that are never found are kept as they are
+            char digits[64];
+            const auto end = *index >= 0 && *index < INT_MAX ? std::to_chars(digits, std::end(digits), static_cast<int>(*index)).ptr
+                                                              : std::to_chars(digits, std::end(digits), *index).ptr;
+            text += '[';
+            text.append(digits, end);
+            text += ']';
+        }
+        else
+            text += "." + std::get<string_t>(key);
     }
+    return text;
+}
+
+const compiled_expr_ptr &expr::empty_compiled()
+{
+    static const compiled_expr_ptr empty = std::make_shared<const compiled_expr>();
+    return empty;
+}
+
+// attach native code to a program that is not shared yet
+bool expr::jit_compile(compiled_expr &compiled)
+{
+    if (!compiled.program_.numeric)
+        return false;
+
+    auto native = std::make_shared<jit_program_t>();
+    if (!native->compile(compiled.program_))
+        return false;
+    compiled.native_entry_ = native->entry();
+    compiled.native_code_ = std::move(native);
+    return true;
+}
+
+bool expr::jit(bool enabled)
+{
+    this->jit_enabled_ = enabled;
+    if (this->compiled_->program_.empty())
+        return false;
+
+    // the compiled program may be shared, the native code goes into a copy
+    auto compiled = std::make_shared<compiled_expr>(*this->compiled_);
+    compiled->native_entry_ = nullptr;
+    compiled->native_code_.reset();
+    bool native = enabled && jit_compile(*compiled);
+    this->compiled_ = compiled;
+    this->context_.compiled_ = std::move(compiled);
+    return native;
+}
+
+void expr::set_native_code(native_entry_t entry, std::shared_ptr<const void> code)
+{
+    auto compiled = std::make_shared<compiled_expr>(*this->compiled_);
+    compiled->native_entry_ = entry;
+    compiled->native_code_ = std::move(code);
+    this->compiled_ = compiled;
+    this->context_.compiled_ = std::move(compiled);
 }
 
 parser_dtype expr::eval()
 {
-    auto result = this->evaluate_postfix(this->output_compiled_);
-    return {result};
+    return this->context_.eval();
+}
+
+expr_result<parser_dtype> expr::try_eval() noexcept
+{
+    return this->context_.try_eval();
 }
 
+// one-off evaluations reuse the programs of the process-wide cache
 parser_dtype expr::eval(const string_t &expression)
 {
-    expr e(expression);
-    e.compile();
-    return e.eval();
+    auto compiled = expr_cache::global().try_get(expression);
+    if (!compiled)
+        throw expr_exception(compiled.error().code, compiled.error().position, compiled.error().message);
+    eval_context context(*compiled);
+    return context.eval();
+}
+
+// the postfix stream is not kept after compiling, it is parsed again
+token_stream_t expr::get_tokens() const
+{
+    if (this->compiled_->program_.empty())
+        return {};
+    return this->shunting_yard(this->tokenize());
 }
 
 void expr::print_tokens(const token_stream_t &tokens) const
@@ -163,7 +293,7 @@ token_stream_t expr::tokenize() const
                 (currentChar == ')' && groupingContextStack.top() != '(') ||
                 (currentChar == ']' && groupingContextStack.top() != '['))
             {
-                throw std::runtime_error("Mismatched grouping symbols");
+                throw expr_exception(expr_errc::SYNTAX, pos, "Mismatched grouping symbols");
             }
 
             // Pop the opening symbol
@@ -196,7 +326,7 @@ token_stream_t expr::tokenize() const
                 if (pos < length && expression_[pos] == '"')
                     ++pos;
                 else
-                    throw std::runtime_error("Unterminated string literal");
+                    throw expr_exception(expr_errc::SYNTAX, pos - literal.size() - 1, "Unterminated string literal");
                 tokens.emplace_back(token_types::LITERAL, data_type::STRING, token_data_t(literal));
                 continue;
             }
@@ -213,7 +343,7 @@ token_stream_t expr::tokenize() const
                 if (pos < length && expression_[pos] == '\'')
                     ++pos;
                 else
-                    throw std::runtime_error("Unterminated string literal");
+                    throw expr_exception(expr_errc::SYNTAX, pos - literal.size() - 1, "Unterminated string literal");
                 tokens.emplace_back(token_types::LITERAL, data_type::STRING, token_data_t(literal));
                 continue;
             }
@@ -231,7 +361,7 @@ token_stream_t expr::tokenize() const
                     {
                         if (decimalPointEncountered)
                         {
-                            throw std::runtime_error("Invalid number format: multiple decimal points");
+                            throw expr_exception(expr_errc::SYNTAX, pos, "Invalid number format: multiple decimal points");
                         }
                         decimalPointEncountered = true;
                     }
@@ -247,7 +377,7 @@ token_stream_t expr::tokenize() const
                     tokens.emplace_back(token_types::LITERAL, data_type::NUMBER, token_data_t(number));
                 }
                 else
-                    throw std::runtime_error("Invalid number format");
+                    throw expr_exception(expr_errc::SYNTAX, pos - numberStr.size(), "Invalid number format");
 
                 continue;
             }
@@ -288,16 +418,16 @@ token_stream_t expr::tokenize() const
                 continue;
             }
             else
-                throw std::runtime_error("Comma found outside function or bracket context");
+                throw expr_exception(expr_errc::SYNTAX, pos, "Comma found outside function or bracket context");
         }
 
         // If an invalid character
-        throw std::runtime_error(std::string("Invalid character in expression: ") + currentChar);
+        throw expr_exception(expr_errc::SYNTAX, pos, std::string("Invalid character in expression: ") + currentChar);
     }
 
     // At the end, ensure all grouping symbols are matched
     if (!groupingContextStack.empty())
-        throw std::runtime_error("Unmatched grouping symbols in expression");
+        throw expr_exception(expr_errc::SYNTAX, length, "Unmatched grouping symbols in expression");
 
     return tokens;
 }
@@ -540,232 +670,2075 @@ token_stream_t expr::shunting_yard(const token_stream_t &tokens) const
 
 #pragma endregion
 
-// # TODO:
-// 1. Evaluar funciones en el stack de operadores con los argumentos en tipado dinamico
-// 2. Asegurar los tipos
-token_data_t expr::evaluate_postfix(const token_stream_t &postfixTokens) const
-{
-    std::stack<token_t> evaluationStack;
 
-    auto resolve_operand = [&](const token_t &operand) -> token_data_t
+#pragma region bytecode
+
+// offset of the first use of a variable or function in the expression text, string literals are
+// skipped. Only for error reports, the tokens do not keep where they were read from
+static size_t identifier_position(const string_t &text, const string_t &name)
+{
+    const auto is_word = [](char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '_'; };
+    for (size_t pos = 0; pos < text.size();)
     {
-        if (operand.type == token_types::LITERAL)
+        const char c = text[pos];
+        if (c == '"' || c == '\'')
         {
-            return operand.value;
+            const size_t end = text.find(c, pos + 1);
+            pos = end == string_t::npos ? text.size() : end + 1;
         }
-        else if (operand.type == token_types::VARIABLE)
+        else if (is_word(c))
         {
-            auto var_name = std::get<string_t>(operand.value);
-            auto var = variables_.find(var_name);
-            if (var != variables_.end())
-            {
-                return var->second;
-            }
-            else
-            {
-                if (unknown_var_resolver_)
-                {
-                    token_data_t value = unknown_var_resolver_(var_name);
-                    json_to_correct_dtype(value);
-                    return value;
-                }
-                else
-                {
-                    throw std::runtime_error("Undefined variable: " + var_name);
-                }
-            }
+            size_t end = pos;
+            while (end < text.size() && is_word(text[end]))
+                end++;
+            if (text.compare(pos, end - pos, name) == 0)
+                return pos;
+            pos = end;
         }
         else
-            return std::numeric_limits<num_t>::quiet_NaN();
-    };
+            pos++;
+    }
+    return expr_error::no_position;
+}
+
+// find the function called by name, builtins take precedence over user functions
+// functions are bound when compiling, so an undefined function is a compile error
+callee_t expr::lookup_function(const string_t &name) const
+{
+    auto func_m = m_parser_builtins::f.find(name);
+    if (func_m != m_parser_builtins::f.end())
+        return {&func_m->second, nullptr};
+
+    auto func_f = f_parser_builtins::f.find(name);
+    if (func_f != f_parser_builtins::f.end())
+        return {nullptr, &func_f->second};
+
+    auto func_u = functions_.find(name);
+    if (func_u != functions_.end())
+        return {nullptr, &func_u->second};
+
+    auto func_a = async_functions_.find(name);
+    if (func_a != async_functions_.end())
+        return {nullptr, nullptr, &func_a->second};
+
+    throw expr_exception(expr_errc::UNDEFINED_FUNCTION, identifier_position(this->expression_, name), "Undefined function: " + name);
+}
+
+// rebuild the expression tree from the postfix tokens, every operator and function
+// takes its operands from the top of the stack
+ast_ptr_t expr::build_ast(const token_stream_t &postfixTokens) const
+{
+    std::vector<ast_ptr_t> stack;
 
     for (const auto &tok : postfixTokens)
     {
         switch (tok.type)
         {
-        case token_types::VARIABLE:
         case token_types::LITERAL:
-        {
-            // Convert the literal to a double and push it onto the stack
-            evaluationStack.push(tok);
+        case token_types::VARIABLE:
+            stack.push_back(std::make_unique<ast_node_t>(tok.type, tok.value));
             break;
-        }
+
+        case token_types::OPERATOR:
         case token_types::FUNCTION:
         {
-            auto func_name = std::get<string_t>(tok.value);
-            auto func_m = m_parser_builtins::f.find(func_name);
-            if (func_m != m_parser_builtins::f.end())
+            const auto &name = std::get<string_t>(tok.value);
+            size_t num_args = tok.type == token_types::OPERATOR ? operator_info_map_.at(name).num_args
+                              : name == "if"                    ? 3
+                                                                : this->lookup_function(name).num_args();
+            if (stack.size() < num_args)
             {
-                std::vector<token_data_t> args;
-                for (int i = 0; i < func_m->second.num_args; i++)
-                {
-                    if (evaluationStack.empty())
-                    {
-                        throw std::runtime_error("Not enough arguments for function: " + std::get<string_t>(tok.value));
-                    }
-                    args.push_back(resolve_operand(evaluationStack.top()));
-                    // args.push_back(evaluationStack.top()); /////////////////////NO ESTA BIEN///////////////////////
-                    evaluationStack.pop();
-                }
+                if (tok.type == token_types::OPERATOR)
+                    throw expr_exception(expr_errc::NOT_ENOUGH_OPERANDS, expr_error::no_position, "Not enough operands for operator: " + name);
+                throw expr_exception(expr_errc::NOT_ENOUGH_OPERANDS, identifier_position(this->expression_, name),
+                                     "Not enough arguments for function: " + name);
+            }
+
+            auto node = std::make_unique<ast_node_t>(tok.type, tok.value);
+            for (auto it = stack.end() - num_args; it != stack.end(); ++it)
+                node->args.push_back(std::move(*it));
+            stack.resize(stack.size() - num_args);
 
-                // Call the function and push the result back onto the stack
-                std::reverse(args.begin(), args.end());
-                auto args_validated = m_parser_builtins::m_function_validator(args.data(), args.size(), func_m->second.num_args);
+            // the right side of '.' is a key and not a variable
+            if (tok.type == token_types::OPERATOR && name == "." && node->args[1]->type == token_types::VARIABLE)
+                node->args[1]->type = token_types::LITERAL;
 
-                num_t result = func_m->second.func(args_validated.data());
-                auto result_t = token_t(token_types::LITERAL, data_type::NUMBER, result);
-                evaluationStack.push(result_t);
+            // c ? a : b is parsed as c ? (a : b), both are turned into if(c, a, b)
+            for (size_t i = 0; i < node->args.size(); i++)
+            {
+                const auto &arg = node->args[i];
+                bool is_colon = arg->type == token_types::OPERATOR && std::get<string_t>(arg->value) == ":";
+                if (is_colon && !(tok.type == token_types::OPERATOR && name == "?" && i == 1))
+                    throw std::runtime_error("Misplaced ':' in conditional expression");
             }
-            else
+            if (tok.type == token_types::OPERATOR && name == "?")
             {
-                auto func_f = f_parser_builtins::f.find(func_name);
-                if (func_f == f_parser_builtins::f.end())
-                {
-                    // check in functions_
-                    func_f = functions_.find(func_name);
-                    if (func_f == functions_.end())
-                    {
-                        throw std::runtime_error("Undefined function: " + func_name);
-                    }
-                }
-
-                std::vector<token_data_t> args;
-                for (int i = 0; i < func_f->second.num_args; i++)
-                {
-                    if (evaluationStack.empty())
-                    {
-                        throw std::runtime_error("Not enough arguments for function: " + std::get<string_t>(tok.value));
-                    }
-                    args.push_back(resolve_operand(evaluationStack.top()));
-                    // args.push_back(evaluationStack.top());
-                    evaluationStack.pop();
-                }
-
-                // Call the function and push the result back onto the stack
-                std::reverse(args.begin(), args.end());
-                auto result = func_f->second.func(args.data());
-                auto dtype = result.index();
-                auto result_t = token_t(token_types::LITERAL, (data_type)dtype, result);
-                evaluationStack.push(result_t);
+                const auto &branches = node->args[1];
+                if (branches->type != token_types::OPERATOR || std::get<string_t>(branches->value) != ":")
+                    throw std::runtime_error("Expected ':' in conditional expression");
+
+                auto cond = std::make_unique<ast_node_t>(token_types::FUNCTION, string_t("if"));
+                cond->args.push_back(std::move(node->args[0]));
+                cond->args.push_back(std::move(branches->args[0]));
+                cond->args.push_back(std::move(branches->args[1]));
+                node = std::move(cond);
             }
+            stack.push_back(std::move(node));
             break;
         }
-        case token_types::OPERATOR:
+
+        default:
+            throw std::runtime_error("Unknown token type");
+        }
+    }
+
+    if (stack.empty())
+        throw std::runtime_error("Invalid expression");
+    // more values than the operators and functions take, e.g. a function called with too many arguments
+    if (stack.size() != 1)
+        throw expr_exception(expr_errc::SYNTAX, expr_error::no_position, "Too many operands or arguments");
+    if (stack.back()->type == token_types::OPERATOR && std::get<string_t>(stack.back()->value) == ":")
+        throw std::runtime_error("Misplaced ':' in conditional expression");
+
+    return std::move(stack.back());
+}
+
+uint32_t expr::name_index(program_t &program, const string_t &name) const
+{
+    auto it = std::find(program.names.begin(), program.names.end(), name);
+    if (it != program.names.end())
+        return static_cast<uint32_t>(it - program.names.begin());
+    program.names.push_back(name);
+    return static_cast<uint32_t>(program.names.size() - 1);
+}
+
+// give every distinct literal a register, equal literals share it. Numbers are compared with their
+// sign so 0 and -0 keep their own registers
+void expr::collect_constants(ast_node_t &node, program_t &program) const
+{
+    if (node.type == token_types::LITERAL)
+    {
+        const auto &value = node.value;
+        auto same = std::find_if(program.constants.begin(), program.constants.end(), [&value](const token_data_t &constant)
+                                 {
+            if (constant.index() != value.index())
+                return false;
+            if (const num_t *number = std::get_if<num_t>(&constant))
+                return *number == std::get<num_t>(value) && std::signbit(*number) == std::signbit(std::get<num_t>(value));
+            return constant == value; });
+        node.reg = static_cast<uint32_t>(same - program.constants.begin());
+        if (same == program.constants.end())
+            program.constants.push_back(value);
+        return;
+    }
+
+    for (auto &arg : node.args)
+        this->collect_constants(*arg, program);
+}
+
+// variables and the . and [] operators, the operands a path step can take by reference
+static bool is_json_path(const ast_node_t &node)
+{
+    if (node.type == token_types::VARIABLE)
+        return true;
+    if (node.type != token_types::OPERATOR || node.args.size() != 2)
+        return false;
+    const auto &name = std::get<string_t>(node.value);
+    return name == "." || name == "[]";
+}
+
+// emit the code that computes node, returns the register that holds the value
+// the value is computed in the temporary for the given stack depth unless it is a constant
+uint32_t expr::lower(const ast_node_t &node, uint32_t depth, program_t &program) const
+{
+    if (node.type == token_types::LITERAL)
+        return node.reg;
+
+    const auto temps = static_cast<uint32_t>(program.constants.size());
+    const uint32_t dst = temps + depth;
+    program.num_registers = std::max(program.num_registers, dst + 1);
+
+    switch (node.type)
+    {
+    case token_types::VARIABLE:
+        // every distinct variable gets a slot, bound to its storage after compiling
+        program.code.push_back({opcode::LOAD_VAR, dst, this->name_index(program, std::get<string_t>(node.value)), 0, 0});
+        break;
+
+    case token_types::OPERATOR:
+    {
+        // operators are resolved here so eval only switches on the opcode
+        const auto op = operator_opcodes_.at(std::get<string_t>(node.value));
+        if (op == opcode::AND || op == opcode::OR)
         {
-            auto op = std::get<string_t>(tok.value);
-            // Pop the operands
-            if (evaluationStack.size() < operator_info_map_.at(op).num_args)
-            {
-                throw std::runtime_error("Not enough operands for operator: " + std::get<string_t>(tok.value));
-            }
-            token_data_t op2 = evaluationStack.top().value;
-            if (op != ".")
-                op2 = resolve_operand(evaluationStack.top());
-            evaluationStack.pop();
-            auto op1 = resolve_operand(evaluationStack.top());
-            evaluationStack.pop();
+            // short-circuit: the right side is skipped when the left side decides the result
+            uint32_t a = this->lower(*node.args[0], depth, program);
+            size_t jump = program.code.size();
+            program.code.push_back({op == opcode::AND ? opcode::AND_JUMP : opcode::OR_JUMP, dst, a, 0, 0});
+            this->lower_into(*node.args[1], depth, program);
+            program.code[jump].c = static_cast<uint32_t>(program.code.size());
+            break;
+        }
 
-            // Perform the operation
-            token_data_t result = 0;
-            if (op == "+")
-            {
-                result = operators_builtins::add_f(op1, op2);
-            }
-            else if (op == "-")
-            {
-                result = operators_builtins::sub_f(op1, op2);
-            }
-            else if (op == "*")
-            {
-                result = operators_builtins::mult_f(op1, op2);
-            }
-            else if (op == "/")
-            {
-                result = operators_builtins::div_f(op1, op2);
-            }
-            else if (op == "%")
-            {
-                result = operators_builtins::mod_f(op1, op2);
-            }
-            else if (op == "^")
-            {
-                result = operators_builtins::pow_f(op1, op2);
-            }
-            else if (op == "==")
-            {
-                result = operators_builtins::eq_f(op1, op2);
-            }
-            else if (op == "!=")
-            {
-                result = operators_builtins::neq_f(op1, op2);
-            }
-            else if (op == "<")
-            {
-                result = operators_builtins::lt_f(op1, op2);
-            }
-            else if (op == "<=")
-            {
-                result = operators_builtins::lte_f(op1, op2);
-            }
-            else if (op == ">")
-            {
-                result = operators_builtins::gt_f(op1, op2);
-            }
-            else if (op == ">=")
-            {
-                result = operators_builtins::gte_f(op1, op2);
-            }
-            else if (op == "&&")
-            {
-                result = operators_builtins::and_f(op1, op2);
-            }
-            else if (op == "||")
-            {
-                result = operators_builtins::or_f(op1, op2);
-            }
-            else if (op == "!")
-            {
-                result = operators_builtins::not_f(op2);
-                evaluationStack.push(token_t(token_types::LITERAL, (data_type)op1.index(), op1));
-            }
-            else if (op == ".")
-            {
-                result = operators_builtins::access_f(op1, op2);
-            }
-            else if (op == "[]")
+        // x * y + z is a single instruction, and so is z + x * y when the sum is numeric
+        if (op == opcode::ADD)
+        {
+            auto is_product = [](const ast_node_t &arg)
             {
-                result = operators_builtins::index_f(op1, op2);
-            }
-            else
+                return arg.type == token_types::OPERATOR && arg.args.size() == 2 && std::get<string_t>(arg.value) == "*";
+            };
+            int product = is_product(*node.args[0])                                           ? 0
+                          : is_product(*node.args[1]) && this->is_numeric(*node.args[0]) &&
+                                    this->is_numeric(*node.args[1])                           ? 1
+                                                                                              : -1;
+            if (product >= 0)
             {
-                throw std::runtime_error("Unknown operator: " + op);
+                // constants stay in their registers, every other operand takes the next temporary
+                uint32_t used = 0;
+                auto operand = [&](const ast_node_t &arg)
+                {
+                    uint32_t reg = this->lower(arg, depth + used, program);
+                    if (reg == dst + used)
+                        used++;
+                    return reg;
+                };
+                const auto &mul = *node.args[product];
+                uint32_t a = operand(*mul.args[0]);
+                uint32_t b = operand(*mul.args[1]);
+                uint32_t c = operand(*node.args[1 - product]);
+                program.code.push_back({opcode::MUL_ADD, dst, a, b, c});
+                break;
             }
-            // Push the result back onto the stack
-            auto dtype = result.index();
-            auto result_t = token_t(token_types::LITERAL, (data_type)dtype, result);
-            evaluationStack.push(result_t);
+        }
 
+        if ((op == opcode::ACCESS || op == opcode::INDEX) && this->lower_path(node, depth, program, false))
+            break;
+        // a chain of . and [] only copies its last element, the steps before it are references
+        const bool by_ref = (op == opcode::ACCESS || op == opcode::INDEX) && is_json_path(*node.args[0]);
+        uint32_t a = by_ref ? this->lower_ref(*node.args[0], depth, program) : this->lower(*node.args[0], depth, program);
+        uint32_t b = a;
+        if (node.args.size() > 1)
+            b = this->lower(*node.args[1], a == dst ? depth + 1 : depth, program);
+        program.code.push_back({op, dst, a, b, by_ref ? 1u : 0u});
+        break;
+    }
+
+    case token_types::FUNCTION:
+    {
+        if (std::get<string_t>(node.value) == "if")
+        {
+            // only the selected branch is evaluated
+            uint32_t cond = this->lower(*node.args[0], depth, program);
+            size_t jump_else = program.code.size();
+            program.code.push_back({opcode::JUMP_IF_FALSE, 0, cond, 0, 0});
+            this->lower_into(*node.args[1], depth, program);
+            size_t jump_end = program.code.size();
+            program.code.push_back({opcode::JUMP, 0, 0, 0, 0});
+            program.code[jump_else].c = static_cast<uint32_t>(program.code.size());
+            this->lower_into(*node.args[2], depth, program);
+            program.code[jump_end].c = static_cast<uint32_t>(program.code.size());
             break;
         }
 
-        default:
+        // arguments must be in consecutive registers
+        const auto num_args = static_cast<uint32_t>(node.args.size());
+        for (uint32_t i = 0; i < num_args; i++)
+            this->lower_into(*node.args[i], depth + i, program);
+        // the callee is copied into the program, eval does not look it up again
+        const auto callee = this->lookup_function(std::get<string_t>(node.value));
+        if (callee.m)
         {
-            throw std::runtime_error("Unknown token type");
+            if (num_args > max_m_function_args)
+                throw std::runtime_error("Too many arguments for function: " + std::get<string_t>(node.value));
+            program.code.push_back({opcode::CALL_M, dst, dst, num_args, static_cast<uint32_t>(program.m_functions.size())});
+            program.m_functions.push_back(*callee.m);
+            program.m_kernels.push_back(simd_builtins::kernel_for(callee.m->func));
+        }
+        else if (callee.f)
+        {
+            program.code.push_back({opcode::CALL_F, dst, dst, num_args, static_cast<uint32_t>(program.f_functions.size())});
+            program.f_functions.push_back(*callee.f);
+        }
+        else
+        {
+            program.code.push_back({opcode::CALL_A, dst, dst, num_args, static_cast<uint32_t>(program.a_functions.size())});
+            program.a_functions.push_back(*callee.a);
+        }
+        break;
+    }
+
+    default:
+        throw std::runtime_error("Unknown token type");
+    }
+    return dst;
+}
+
+// emit the code of the operand of a path step, it leaves a reference to its json in ref[dst] or its
+// value in r[dst]. Returns dst
+uint32_t expr::lower_ref(const ast_node_t &node, uint32_t depth, program_t &program) const
+{
+    const uint32_t dst = static_cast<uint32_t>(program.constants.size()) + depth;
+    program.num_registers = std::max(program.num_registers, dst + 1);
+    if (node.type == token_types::VARIABLE)
+    {
+        program.code.push_back({opcode::LOAD_REF, dst, this->name_index(program, std::get<string_t>(node.value)), 0, 0});
+        return dst;
+    }
+    if (this->lower_path(node, depth, program, true))
+        return dst;
+
+    const bool by_ref = is_json_path(*node.args[0]);
+    uint32_t a = by_ref ? this->lower_ref(*node.args[0], depth, program) : this->lower(*node.args[0], depth, program);
+    uint32_t b = this->lower(*node.args[1], a == dst ? depth + 1 : depth, program);
+    const auto op = std::get<string_t>(node.value) == "[]" ? opcode::INDEX_REF : opcode::ACCESS_REF;
+    program.code.push_back({op, dst, a, b, by_ref ? 1u : 0u});
+    return dst;
+}
+
+// Two or more . and [] with constant keys at the end of a chain become a single PATH or PATH_VAR
+// instruction into the temporary for the given depth, by_ref like lower_ref(). The steps before
+// the first dynamic key (or that are not a json path) are lowered as usual. Returns false when
+// there are not enough constant steps
+bool expr::lower_path(const ast_node_t &node, uint32_t depth, program_t &program, bool by_ref) const
+{
+    std::vector<uint32_t> keys;
+    const ast_node_t *base = &node;
+    while (base->type == token_types::OPERATOR && base->args.size() == 2 && base->args[1]->type == token_types::LITERAL)
+    {
+        const auto &name = std::get<string_t>(base->value);
+        const auto &key = base->args[1]->value;
+        if (!(name == "." && std::holds_alternative<string_t>(key)) && !(name == "[]" && std::holds_alternative<num_t>(key)))
+            break;
+        keys.push_back(base->args[1]->reg);
+        base = base->args[0].get();
+    }
+    if (keys.size() < 2)
+        return false;
+
+    const uint32_t dst = static_cast<uint32_t>(program.constants.size()) + depth;
+    const auto path = static_cast<uint32_t>(program.path_keys.size());
+    program.path_keys.push_back(static_cast<uint32_t>(keys.size()));
+    program.path_keys.insert(program.path_keys.end(), keys.rbegin(), keys.rend());
+    if (base->type == token_types::VARIABLE)
+    {
+        program.code.push_back({opcode::PATH_VAR, dst, this->name_index(program, std::get<string_t>(base->value)), path, by_ref ? 1u : 0u});
+        return true;
+    }
+    const bool operand_ref = is_json_path(*base);
+    uint32_t a = operand_ref ? this->lower_ref(*base, depth, program) : this->lower(*base, depth, program);
+    program.code.push_back({opcode::PATH, dst, a, path, (operand_ref ? 1u : 0u) | (by_ref ? 2u : 0u)});
+    return true;
+}
+
+// same as lower() but the value always ends in the temporary for the given depth
+void expr::lower_into(const ast_node_t &node, uint32_t depth, program_t &program) const
+{
+    const uint32_t dst = static_cast<uint32_t>(program.constants.size()) + depth;
+    uint32_t reg = this->lower(node, depth, program);
+    if (reg != dst)
+    {
+        program.num_registers = std::max(program.num_registers, dst + 1);
+        program.code.push_back({opcode::MOVE, dst, reg, 0, 0});
+    }
+}
+
+// record the values read from the variables and the functions called. A chain of . and [] reads its
+// variable down to the first key that is not a constant of the type of its step, the keys of dynamic
+// steps are visited
+void expr::collect_dependencies(const ast_node_t &node, program_t &program) const
+{
+    if (!is_json_path(node))
+    {
+        if (node.type == token_types::FUNCTION)
+        {
+            // if is control flow, not a call
+            const auto &name = std::get<string_t>(node.value);
+            if (name != "if" && std::find(program.functions.begin(), program.functions.end(), name) == program.functions.end())
+                program.functions.push_back(name);
+        }
+        for (const auto &arg : node.args)
+            this->collect_dependencies(*arg, program);
+        return;
+    }
+
+    std::vector<token_data_t> keys;
+    bool dynamic = false;
+    const ast_node_t *base = &node;
+    while (base->type == token_types::OPERATOR && is_json_path(*base))
+    {
+        const auto &key = *base->args[1];
+        const bool index = std::get<string_t>(base->value) == "[]";
+        if (key.type == token_types::LITERAL && std::holds_alternative<num_t>(key.value) == index)
+            keys.push_back(key.value);
+        else
+        {
+            // the steps after this one depend on the key
+            keys.clear();
+            dynamic = true;
+            this->collect_dependencies(key, program);
         }
+        base = base->args[0].get();
+    }
+    if (base->type != token_types::VARIABLE)
+    {
+        this->collect_dependencies(*base, program);
+        return;
+    }
+
+    json_path_t path{this->name_index(program, std::get<string_t>(base->value)), {keys.rbegin(), keys.rend()}, dynamic};
+    auto same = std::find_if(program.json_paths.begin(), program.json_paths.end(), [&path](const json_path_t &other)
+                             { return other.slot == path.slot && other.keys == path.keys; });
+    if (same != program.json_paths.end())
+        same->dynamic |= path.dynamic;
+    else
+        program.json_paths.push_back(std::move(path));
+}
+
+program_t expr::generate_program(ast_node_t &root) const
+{
+    program_t program;
+    this->collect_constants(root, program);
+    program.num_registers = static_cast<uint32_t>(program.constants.size());
+    program.result = this->lower(root, 0, program);
+    program.code.push_back({opcode::RETURN, 0, program.result, 0, 0});
+    this->collect_dependencies(root, program);
+    // every operand is below one of these
+    if (program.code.size() > max_operand || program.num_registers > max_operand || program.names.size() > max_operand ||
+        program.path_keys.size() > max_operand)
+        throw expr_exception(expr_errc::TOO_LARGE, expr_error::no_position, "Expression is too large");
+    this->fuse_instructions(program);
+
+    // the optimizer and the numeric program rely on the type of variables bound to numbers or strings
+    for (const auto &name : program.names)
+    {
+        auto binding = this->bindings_.find(name);
+        auto kind = binding != this->bindings_.end() ? binding->second.kind : binding_kind::NONE;
+        program.slot_types.push_back(kind == binding_kind::NUMBER || kind == binding_kind::STRING ? kind : binding_kind::NONE);
+    }
+
+    program.numeric = this->is_numeric_only(root);
+    program.numeric_code = std::all_of(program.constants.begin(), program.constants.end(),
+                                       [](const token_data_t &constant)
+                                       { return std::holds_alternative<num_t>(constant); }) &&
+                           std::none_of(program.code.begin(), program.code.end(), [](const instruction_t &ins)
+                                        { return ins.op == opcode::CALL_F || ins.op == opcode::CALL_A || ins.op == opcode::AND || ins.op == opcode::OR ||
+                                                 ins.op == opcode::ACCESS || ins.op == opcode::INDEX || ins.op == opcode::ACCESS_VAR ||
+                                                 ins.op == opcode::LOAD_REF || ins.op == opcode::ACCESS_REF || ins.op == opcode::INDEX_REF ||
+                                                 ins.op == opcode::PATH || ins.op == opcode::PATH_VAR; });
+    if (program.numeric_code)
+    {
+        for (const auto &constant : program.constants)
+            program.num_constants.push_back(std::get<num_t>(constant));
+    }
+    return program;
+}
+
+// Peephole pass, a variable loaded into a temporary that is only read by the next instruction:
+//  - LOAD_VAR t, x; <op> d, t, k          -> BINARY_VAR d, x, k    (k is a constant, op is ADD ... GTE)
+//  - LOAD_REF t, x; ACCESS/INDEX(_REF) d, t, k -> ACCESS_VAR d, x, k
+//  - up to three LOAD_VAR into consecutive registers -> LOAD_VAR2 / LOAD_VAR3
+// an instruction that is the target of a jump is never merged into the previous one
+void expr::fuse_instructions(program_t &program) const
+{
+    const auto &code = program.code;
+    const auto nconst = static_cast<uint32_t>(program.constants.size());
+    std::vector<bool> target(code.size() + 1, false);
+    for (const auto &ins : code)
+    {
+        if (ins.op == opcode::JUMP || ins.op == opcode::JUMP_IF_FALSE || ins.op == opcode::AND_JUMP || ins.op == opcode::OR_JUMP)
+            target[ins.c] = true;
+    }
+
+    std::vector<instruction_t> fused;
+    std::vector<uint32_t> new_pc(code.size() + 1, 0);
+    for (size_t pc = 0; pc < code.size();)
+    {
+        new_pc[pc] = static_cast<uint32_t>(fused.size());
+        const auto &ins = code[pc];
+        size_t length = 1;
+        fused.push_back(ins);
 
-            // The final result should be on the stack
-            if (evaluationStack.size() != 1)
+        if (ins.op == opcode::LOAD_VAR && pc + 1 < code.size() && !target[pc + 1])
+        {
+            const auto &next = code[pc + 1];
+            const bool reads_temp = next.a == ins.dst && next.b < nconst;
+            if (reads_temp && next.op >= opcode::ADD && next.op <= opcode::GTE)
+            {
+                fused.back() = {opcode::BINARY_VAR, next.dst, ins.a, next.b, static_cast<uint32_t>(next.op)};
+                length = 2;
+            }
+            else
+            {
+                // LOAD_VAR2 keeps the second slot in b, LOAD_VAR3 the third in c
+                while (length < 3 && pc + length < code.size() && !target[pc + length] &&
+                       code[pc + length].op == opcode::LOAD_VAR && code[pc + length].dst == ins.dst + length)
+                {
+                    if (length == 1)
+                        fused.back() = {opcode::LOAD_VAR2, ins.dst, ins.a, code[pc + 1].a, 0};
+                    else
+                        fused.back() = {opcode::LOAD_VAR3, ins.dst, ins.a, fused.back().b, code[pc + 2].a};
+                    length++;
+                }
+            }
+        }
+        else if (ins.op == opcode::LOAD_REF && pc + 1 < code.size() && !target[pc + 1])
+        {
+            const auto &next = code[pc + 1];
+            if (next.a == ins.dst && next.c == 1 && next.b < nconst &&
+                (next.op == opcode::ACCESS || next.op == opcode::INDEX || next.op == opcode::ACCESS_REF || next.op == opcode::INDEX_REF))
             {
-                throw std::runtime_error("Invalid this->expression_");
+                fused.back() = {opcode::ACCESS_VAR, next.dst, ins.a, next.b, static_cast<uint32_t>(next.op)};
+                length = 2;
             }
-            return evaluationStack.top().value;
         }
+        pc += length;
+    }
+    new_pc[code.size()] = static_cast<uint32_t>(fused.size());
+
+    for (auto &ins : fused)
+    {
+        if (ins.op == opcode::JUMP || ins.op == opcode::JUMP_IF_FALSE || ins.op == opcode::AND_JUMP || ins.op == opcode::OR_JUMP)
+            ins.c = new_pc[ins.c];
+    }
+    program.code = std::move(fused);
+}
+
+// Dispatch of the interpreters: with GCC and Clang every handler jumps straight to the next
+// one through a table of label addresses (threaded code), so each instruction has its own
+// indirect branch to predict. Elsewhere, or with EXPR_NO_THREADED_DISPATCH, a switch in a loop.
+#if defined(__GNUC__) && !defined(EXPR_NO_THREADED_DISPATCH)
+#define VM_THREADED
+#endif
+
+// opcodes in declaration order, the dispatch tables are indexed by opcode
+#define VM_OPCODES(X)                                                                     \
+    X(LOAD_VAR) X(LOAD_VAR2) X(LOAD_VAR3) X(LOAD_REF) X(MOVE) X(CALL_M) X(CALL_F) X(CALL_A) \
+    X(JUMP) X(JUMP_IF_FALSE) X(AND_JUMP) X(OR_JUMP)                                         \
+    X(ADD) X(SUB) X(MUL) X(DIV) X(MOD) X(POW) X(EQ) X(NEQ) X(LT) X(LTE) X(GT) X(GTE)        \
+    X(AND) X(OR) X(NOT) X(ACCESS) X(INDEX) X(ACCESS_REF) X(INDEX_REF) X(PATH)               \
+    X(MUL_ADD) X(BINARY_VAR) X(ACCESS_VAR) X(PATH_VAR) X(RETURN)
+
+#define VM_OPCODE_ENTRY(name) opcode::name,
+static constexpr opcode vm_opcodes[] = {VM_OPCODES(VM_OPCODE_ENTRY)};
+
+static constexpr bool vm_opcodes_in_order()
+{
+    for (size_t i = 0; i < num_opcodes; i++)
+    {
+        if (static_cast<size_t>(vm_opcodes[i]) != i)
+            return false;
+    }
+    return true;
+}
+static_assert(sizeof(vm_opcodes) / sizeof(opcode) == num_opcodes && vm_opcodes_in_order(), "VM_OPCODES is out of date");
+
+#ifdef VM_THREADED
+#define VM_LABEL_ADDRESS(name) &&op_##name,
+#define VM_BEGIN                                                        \
+    static const void *const dispatch[] = {VM_OPCODES(VM_LABEL_ADDRESS)}; \
+    goto *dispatch[static_cast<size_t>(ip->op)];
+#define VM_END
+#define VM_OP(name) op_##name:
+#define VM_NEXT                                \
+    ++ip;                                      \
+    goto *dispatch[static_cast<size_t>(ip->op)]
+#define VM_GOTO(target)                        \
+    ip = code + (target);                      \
+    goto *dispatch[static_cast<size_t>(ip->op)]
+#else
+#define VM_BEGIN   \
+    for (;;)       \
+    {              \
+        switch (ip->op) \
+        {
+#define VM_END \
+    }          \
+    }
+#define VM_OP(name) case opcode::name:
+#define VM_NEXT \
+    ++ip;       \
+    continue
+#define VM_GOTO(target)   \
+    ip = code + (target); \
+    continue
+#endif
+
+// string + string and string + number written into dst, like add_f. The string a register holds keeps
+// its capacity from one evaluation to the next, so once a chain of concatenations has run it only
+// allocates for longer strings. Returns false for the other types
+static bool concat_into(token_data_t &dst, const token_data_t &a, const token_data_t &b)
+{
+    const string_t *sa = std::get_if<string_t>(&a), *sb = std::get_if<string_t>(&b);
+    if ((!sa && !sb) || (!sa && !std::holds_alternative<num_t>(a)) || (!sb && !std::holds_alternative<num_t>(b)) || &dst == &b)
+        return false;
+
+    if (!sa)
+        dst = operators_builtins::num_to_string(std::get<num_t>(a));
+    else if (&dst != &a)
+    {
+        if (auto *out = std::get_if<string_t>(&dst))
+            out->assign(*sa);
+        else
+            dst = *sa;
     }
+    auto &out = std::get<string_t>(dst);
+    if (sb)
+        out.append(*sb);
+    else
+        out.append(operators_builtins::num_to_string(std::get<num_t>(b)));
+    return true;
+}
 
-    // if the top is a variable, resolve it
-    if (evaluationStack.size() == 1 && evaluationStack.top().type == token_types::VARIABLE)
+// operators ADD ... GTE for the superinstructions that take the operator in c
+static token_data_t binary_values(opcode op, const token_data_t &a, const token_data_t &b)
+{
+    switch (op)
     {
-        return resolve_operand(evaluationStack.top());
+    case opcode::ADD:
+        return operators_builtins::add_f(a, b);
+    case opcode::SUB:
+        return operators_builtins::sub_f(a, b);
+    case opcode::MUL:
+        return operators_builtins::mult_f(a, b);
+    case opcode::DIV:
+        return operators_builtins::div_f(a, b);
+    case opcode::MOD:
+        return operators_builtins::mod_f(a, b);
+    case opcode::POW:
+        return operators_builtins::pow_f(a, b);
+    case opcode::EQ:
+        return operators_builtins::eq_f(a, b);
+    case opcode::NEQ:
+        return operators_builtins::neq_f(a, b);
+    case opcode::LT:
+        return operators_builtins::lt_f(a, b);
+    case opcode::LTE:
+        return operators_builtins::lte_f(a, b);
+    case opcode::GT:
+        return operators_builtins::gt_f(a, b);
+    default:
+        return operators_builtins::gte_f(a, b);
     }
-    return evaluationStack.top().value;
 }
+
+static num_t binary_numbers(opcode op, num_t a, num_t b)
+{
+    switch (op)
+    {
+    case opcode::ADD:
+        return a + b;
+    case opcode::SUB:
+        return a - b;
+    case opcode::MUL:
+        return a * b;
+    case opcode::DIV:
+        return a / b;
+    case opcode::MOD:
+        return std::fmod(a, b);
+    case opcode::POW:
+        return std::pow(a, b);
+    case opcode::EQ:
+        return a == b;
+    case opcode::NEQ:
+        return a != b;
+    case opcode::LT:
+        return a < b;
+    case opcode::LTE:
+        return a <= b;
+    case opcode::GT:
+        return a > b;
+    default:
+        return a >= b;
+    }
+}
+
+eval_context::eval_context(compiled_expr_ptr compiled)
+{
+    this->reset(std::move(compiled));
+}
+
+// evaluate another program with no variable bound, the buffers the context already has are reused
+void eval_context::reset(compiled_expr_ptr compiled)
+{
+    this->compiled_ = std::move(compiled);
+    // constants are loaded once, temporaries are overwritten on every eval
+    const auto &program = this->compiled_->program_;
+    this->registers_.assign(program.constants.begin(), program.constants.end());
+    this->registers_.resize(program.num_registers);
+    this->num_registers_.assign(program.num_constants.begin(), program.num_constants.end());
+    this->num_registers_.resize(program.numeric_code ? program.num_registers : 0);
+    this->refs_.assign(program.numeric_code ? 0 : program.num_registers, nullptr);
+    this->slots_.assign(program.names.size(), slot_binding_t());
+    this->values_.clear();
+    this->values_.resize(program.names.size());
+    this->shared_.clear();
+    this->slots_checked_ = false;
+    this->numeric_slots_ = false;
+}
+
+// drops the program, the values and everything that points out of the context, the buffers keep
+// their capacity for the next reset()
+void eval_context::release()
+{
+    this->compiled_.reset();
+    this->registers_.clear();
+    this->num_registers_.clear();
+    this->refs_.clear();
+    this->slots_.clear();
+    this->values_.clear();
+    this->shared_.clear();
+    this->unknown_var_resolver_ = nullptr;
+    this->async_var_resolver_ = nullptr;
+    this->batch_columns_.clear();
+    this->batch_bases_.clear();
+    this->batch_saved_slots_.clear();
+}
+
+parser_dtype eval_context::eval()
+{
+    if (!this->compiled_ || this->compiled_->program_.empty())
+        throw std::runtime_error("Expression is not compiled");
+    if (!this->slots_checked_)
+        this->check_slots();
+
+    if (this->compiled_->native_entry_)
+        return {this->compiled_->native_entry_(this->num_registers_.data(), this->slots_.data())};
+    if (this->numeric_slots_)
+        return {this->run_numeric()};
+    return {*this->run()};
+}
+
+// eval() that reports its errors instead of throwing them. An undefined variable or an asynchronous
+// call stops run() like a suspension of eval_async(), so the common errors do not unwind the stack;
+// only the exceptions of user functions, resolvers and json operations are caught
+expr_result<parser_dtype> eval_context::try_eval() noexcept
+{
+    try
+    {
+        if (!this->compiled_ || this->compiled_->program_.empty())
+            return expr_error{expr_errc::NOT_COMPILED, expr_error::no_position, {}, {}};
+        const auto &program = this->compiled_->program_;
+        if (!this->slots_checked_)
+        {
+            const size_t slot = this->mismatched_slot();
+            if (slot < this->slots_.size())
+            {
+                const auto code = this->slots_[slot].kind == binding_kind::NONE ? expr_errc::UNDEFINED_VARIABLE : expr_errc::TYPE_MISMATCH;
+                return expr_error{code, identifier_position(this->compiled_->expression_, program.names[slot]), program.names[slot], {}};
+            }
+            this->check_slots();
+        }
+
+        if (this->compiled_->native_entry_)
+            return parser_dtype{this->compiled_->native_entry_(this->num_registers_.data(), this->slots_.data())};
+        if (this->numeric_slots_)
+            return parser_dtype{this->run_numeric()};
+
+        this->no_throw_ = true;
+        const token_data_t *result = this->run();
+        this->no_throw_ = false;
+        if (result)
+            return parser_dtype{*result};
+
+        if (this->fault_ == expr_errc::UNDEFINED_VARIABLE)
+        {
+            const auto &name = program.names[this->await_slot_];
+            return expr_error{expr_errc::UNDEFINED_VARIABLE, identifier_position(this->compiled_->expression_, name), name, {}};
+        }
+        return expr_error{this->fault_, expr_error::no_position, {}, {}};
+    }
+    catch (const std::exception &ex)
+    {
+        this->no_throw_ = false;
+        return expr_error{expr_errc::FUNCTION_ERROR, expr_error::no_position, {}, ex.what()};
+    }
+    catch (...)
+    {
+        this->no_throw_ = false;
+        return expr_error{expr_errc::FUNCTION_ERROR, expr_error::no_position, {}, "Unknown exception"};
+    }
+}
+
+// value of a variable slot, converted like the values given to set_variables. Returns false when
+// eval_async() has to await the value of an unknown variable first, or when try_eval() stops at
+// an undefined one
+bool eval_context::load_variable(uint32_t slot_index, token_data_t &reg)
+{
+    const auto &slot = this->slots_[slot_index];
+    switch (slot.kind)
+    {
+    case binding_kind::VALUE:
+        reg = *static_cast<const token_data_t *>(slot.ptr);
+        break;
+    case binding_kind::NUMBER:
+        reg = *static_cast<const num_t *>(slot.ptr);
+        break;
+    case binding_kind::STRING:
+        reg = *static_cast<const string_t *>(slot.ptr);
+        break;
+    case binding_kind::JSON:
+    {
+        // same conversion as json_to_correct_dtype
+        const auto &j = *static_cast<const json_t *>(slot.ptr);
+        if (json_is_number(j))
+            reg = j.get<num_t>();
+        else if (j.is_string())
+            reg = j.get<string_t>();
+        else
+            reg = j;
+        break;
+    }
+    case binding_kind::NONE:
+    {
+        if (this->awaiting_ && this->async_var_resolver_)
+        {
+            this->await_slot_ = slot_index;
+            return false;
+        }
+        const auto &var_name = this->compiled_->program_.names[slot_index];
+        if (!unknown_var_resolver_)
+        {
+            if (this->no_throw_)
+            {
+                this->fault_ = expr_errc::UNDEFINED_VARIABLE;
+                this->await_slot_ = slot_index;
+                return false;
+            }
+            throw std::runtime_error("Undefined variable: " + var_name);
+        }
+
+        token_data_t value = unknown_var_resolver_(var_name);
+        json_to_correct_dtype(value);
+        reg = std::move(value);
+        break;
+    }
+    }
+    return true;
+}
+
+// json bound to a slot that would be loaded as a json, nullptr for any other value
+const json_t *eval_context::bound_json(uint32_t slot_index) const
+{
+    const auto &slot = this->slots_[slot_index];
+    if (slot.kind == binding_kind::VALUE)
+        return std::get_if<json_t>(static_cast<const token_data_t *>(slot.ptr));
+    if (slot.kind == binding_kind::JSON)
+    {
+        const auto &j = *static_cast<const json_t *>(slot.ptr);
+        return json_is_number(j) || j.is_string() ? nullptr : &j;
+    }
+    return nullptr;
+}
+
+static const json_t null_json;
+
+// element a.b or a[b] of a json without copying it, like access_json and index_json. A missing one
+// is the null json, nullptr when the key has the wrong type (the operators give NaN)
+static const json_t *child_json(const json_t &j, const token_data_t &key, bool index)
+{
+    if (index)
+    {
+        const num_t *number = std::get_if<num_t>(&key);
+        if (!number)
+            return nullptr;
+        const auto i = static_cast<int>(*number);
+        return j.is_array() && i >= 0 && i < static_cast<int>(j.size()) ? &j[i] : &null_json;
+    }
+    const string_t *name = std::get_if<string_t>(&key);
+    if (!name)
+        return nullptr;
+    auto it = j.find(*name);
+    return it != j.end() ? &*it : &null_json;
+}
+
+// ACCESS_REF and INDEX_REF, base is the json operand or nullptr when it is the value in operand
+void eval_context::step_ref(const json_t *base, const token_data_t &operand, const token_data_t &key, bool index, uint32_t dst)
+{
+    if (!base)
+        base = std::get_if<json_t>(&operand);
+    if (base)
+    {
+        if (const json_t *child = child_json(*base, key, index))
+        {
+            this->refs_[dst] = child;
+            return;
+        }
+        this->registers_[dst] = std::numeric_limits<num_t>::quiet_NaN();
+    }
+    else
+        this->registers_[dst] = index ? operators_builtins::index_f(operand, key) : operators_builtins::access_f(operand, key);
+    this->refs_[dst] = nullptr;
+}
+
+// PATH and PATH_VAR, base is the json operand or nullptr when it is the value in operand. A json is
+// walked down without copying anything but the result; any other value goes through the operators
+void eval_context::walk_path(const json_t *base, const token_data_t &operand, uint32_t path, bool by_ref, uint32_t dst)
+{
+    const auto &program = this->compiled_->program_;
+    const uint32_t *keys = program.path_keys.data() + path + 1;
+    const uint32_t num_keys = program.path_keys[path];
+    if (!base)
+        base = std::get_if<json_t>(&operand);
+    if (base)
+    {
+        // the keys have the type of their step, child_json always finds something
+        for (uint32_t i = 0; i < num_keys; i++)
+        {
+            const auto &key = program.constants[keys[i]];
+            base = child_json(*base, key, std::holds_alternative<num_t>(key));
+        }
+        if (by_ref)
+            this->refs_[dst] = base;
+        else
+            this->registers_[dst] = token_data_t(*base);
+        return;
+    }
+
+    token_data_t value = operand;
+    for (uint32_t i = 0; i < num_keys; i++)
+    {
+        const auto &key = program.constants[keys[i]];
+        value = std::holds_alternative<num_t>(key) ? operators_builtins::index_f(value, key) : operators_builtins::access_f(value, key);
+    }
+    this->registers_[dst] = std::move(value);
+    if (by_ref)
+        this->refs_[dst] = nullptr;
+}
+
+// execute the compiled program over the register file from instruction pc, no allocation is done
+// for numeric values. Only eval_async() and try_eval() stop before the end: they return nullptr with
+// await_pc_ at the instruction to run again once the value it waits for is there
+const token_data_t *eval_context::run(uint32_t pc)
+{
+    token_data_t *regs = this->registers_.data();
+    const instruction_t *code = this->compiled_->program_.code.data();
+    const instruction_t *ip = code + pc;
+
+#define VM_LOAD(slot, reg)                                   \
+    if (!this->load_variable(slot, reg))                     \
+    {                                                        \
+        this->await_pc_ = static_cast<uint32_t>(ip - code); \
+        return nullptr;                                      \
+    }
+
+    VM_BEGIN
+
+    VM_OP(LOAD_VAR)
+    VM_LOAD(ip->a, regs[ip->dst]);
+    VM_NEXT;
+    VM_OP(LOAD_VAR2)
+    VM_LOAD(ip->a, regs[ip->dst]);
+    VM_LOAD(ip->b, regs[ip->dst + 1]);
+    VM_NEXT;
+    VM_OP(LOAD_VAR3)
+    VM_LOAD(ip->a, regs[ip->dst]);
+    VM_LOAD(ip->b, regs[ip->dst + 1]);
+    VM_LOAD(ip->c, regs[ip->dst + 2]);
+    VM_NEXT;
+    VM_OP(LOAD_REF)
+    if (!(this->refs_[ip->dst] = this->bound_json(ip->a)))
+    {
+        VM_LOAD(ip->a, regs[ip->dst]);
+    }
+    VM_NEXT;
+    VM_OP(MOVE)
+    regs[ip->dst] = regs[ip->a];
+    VM_NEXT;
+
+    VM_OP(CALL_M)
+    {
+        num_t args[max_m_function_args];
+        for (uint32_t i = 0; i < ip->b; i++)
+            args[i] = m_parser_builtins::m_argument_to_number(regs[ip->a + i]);
+        regs[ip->dst] = this->compiled_->program_.m_functions[ip->c].func(args);
+        VM_NEXT;
+    }
+    VM_OP(CALL_F)
+    regs[ip->dst] = this->compiled_->program_.f_functions[ip->c].func(regs + ip->a);
+    VM_NEXT;
+    VM_OP(CALL_A)
+    if (!this->awaiting_)
+    {
+        if (!this->no_throw_)
+            throw std::runtime_error("Asynchronous function called by eval(), use eval_async()");
+        this->fault_ = expr_errc::ASYNC_FUNCTION;
+    }
+    this->await_pc_ = static_cast<uint32_t>(ip - code);
+    return nullptr;
+
+    VM_OP(JUMP)
+    VM_GOTO(ip->c);
+    VM_OP(JUMP_IF_FALSE)
+    if (!operators_builtins::truthy_f(regs[ip->a]))
+    {
+        VM_GOTO(ip->c);
+    }
+    VM_NEXT;
+    VM_OP(AND_JUMP)
+    if (!operators_builtins::truthy_f(regs[ip->a]))
+    {
+        regs[ip->dst] = operators_builtins::falsy_f(regs[ip->a]);
+        VM_GOTO(ip->c);
+    }
+    VM_NEXT;
+    VM_OP(OR_JUMP)
+    if (operators_builtins::truthy_f(regs[ip->a]))
+    {
+        if (ip->dst != ip->a)
+            regs[ip->dst] = regs[ip->a];
+        VM_GOTO(ip->c);
+    }
+    VM_NEXT;
+
+    VM_OP(ADD)
+    if (!concat_into(regs[ip->dst], regs[ip->a], regs[ip->b]))
+        regs[ip->dst] = operators_builtins::add_f(regs[ip->a], regs[ip->b]);
+    VM_NEXT;
+    VM_OP(SUB)
+    regs[ip->dst] = operators_builtins::sub_f(regs[ip->a], regs[ip->b]);
+    VM_NEXT;
+    VM_OP(MUL)
+    regs[ip->dst] = operators_builtins::mult_f(regs[ip->a], regs[ip->b]);
+    VM_NEXT;
+    VM_OP(DIV)
+    regs[ip->dst] = operators_builtins::div_f(regs[ip->a], regs[ip->b]);
+    VM_NEXT;
+    VM_OP(MOD)
+    regs[ip->dst] = operators_builtins::mod_f(regs[ip->a], regs[ip->b]);
+    VM_NEXT;
+    VM_OP(POW)
+    regs[ip->dst] = operators_builtins::pow_f(regs[ip->a], regs[ip->b]);
+    VM_NEXT;
+    VM_OP(EQ)
+    regs[ip->dst] = operators_builtins::eq_f(regs[ip->a], regs[ip->b]);
+    VM_NEXT;
+    VM_OP(NEQ)
+    regs[ip->dst] = operators_builtins::neq_f(regs[ip->a], regs[ip->b]);
+    VM_NEXT;
+    VM_OP(LT)
+    regs[ip->dst] = operators_builtins::lt_f(regs[ip->a], regs[ip->b]);
+    VM_NEXT;
+    VM_OP(LTE)
+    regs[ip->dst] = operators_builtins::lte_f(regs[ip->a], regs[ip->b]);
+    VM_NEXT;
+    VM_OP(GT)
+    regs[ip->dst] = operators_builtins::gt_f(regs[ip->a], regs[ip->b]);
+    VM_NEXT;
+    VM_OP(GTE)
+    regs[ip->dst] = operators_builtins::gte_f(regs[ip->a], regs[ip->b]);
+    VM_NEXT;
+    VM_OP(AND)
+    regs[ip->dst] = operators_builtins::and_f(regs[ip->a], regs[ip->b]);
+    VM_NEXT;
+    VM_OP(OR)
+    regs[ip->dst] = operators_builtins::or_f(regs[ip->a], regs[ip->b]);
+    VM_NEXT;
+    VM_OP(NOT)
+    regs[ip->dst] = operators_builtins::not_f(regs[ip->a]);
+    VM_NEXT;
+    VM_OP(ACCESS)
+    if (const json_t *j = ip->c ? this->refs_[ip->a] : nullptr)
+        regs[ip->dst] = operators_builtins::access_json(*j, regs[ip->b]);
+    else
+        regs[ip->dst] = operators_builtins::access_f(regs[ip->a], regs[ip->b]);
+    VM_NEXT;
+    VM_OP(INDEX)
+    if (const json_t *j = ip->c ? this->refs_[ip->a] : nullptr)
+        regs[ip->dst] = operators_builtins::index_json(*j, regs[ip->b]);
+    else
+        regs[ip->dst] = operators_builtins::index_f(regs[ip->a], regs[ip->b]);
+    VM_NEXT;
+    VM_OP(ACCESS_REF)
+    this->step_ref(ip->c ? this->refs_[ip->a] : nullptr, regs[ip->a], regs[ip->b], false, ip->dst);
+    VM_NEXT;
+    VM_OP(INDEX_REF)
+    this->step_ref(ip->c ? this->refs_[ip->a] : nullptr, regs[ip->a], regs[ip->b], true, ip->dst);
+    VM_NEXT;
+    VM_OP(PATH)
+    this->walk_path(ip->c & 1 ? this->refs_[ip->a] : nullptr, regs[ip->a], ip->b, (ip->c & 2) != 0, ip->dst);
+    VM_NEXT;
+
+    VM_OP(MUL_ADD)
+    regs[ip->dst] = operators_builtins::add_f(operators_builtins::mult_f(regs[ip->a], regs[ip->b]), regs[ip->c]);
+    VM_NEXT;
+    VM_OP(BINARY_VAR)
+    // dst is free until the result is written, the variable is loaded there
+    VM_LOAD(ip->a, regs[ip->dst]);
+    if (static_cast<opcode>(ip->c) != opcode::ADD || !concat_into(regs[ip->dst], regs[ip->dst], regs[ip->b]))
+        regs[ip->dst] = binary_values(static_cast<opcode>(ip->c), regs[ip->dst], regs[ip->b]);
+    VM_NEXT;
+    VM_OP(ACCESS_VAR)
+    {
+        const auto step = static_cast<opcode>(ip->c);
+        const bool index = step == opcode::INDEX || step == opcode::INDEX_REF;
+        const json_t *j = this->bound_json(ip->a);
+        if (!j)
+        {
+            VM_LOAD(ip->a, regs[ip->dst]);
+        }
+        if (step == opcode::ACCESS_REF || step == opcode::INDEX_REF)
+            this->step_ref(j, regs[ip->dst], regs[ip->b], index, ip->dst);
+        else if (j)
+            regs[ip->dst] = index ? operators_builtins::index_json(*j, regs[ip->b]) : operators_builtins::access_json(*j, regs[ip->b]);
+        else
+            regs[ip->dst] = index ? operators_builtins::index_f(regs[ip->dst], regs[ip->b]) : operators_builtins::access_f(regs[ip->dst], regs[ip->b]);
+        VM_NEXT;
+    }
+    VM_OP(PATH_VAR)
+    {
+        const json_t *j = this->bound_json(ip->a);
+        if (!j)
+        {
+            VM_LOAD(ip->a, regs[ip->dst]);
+        }
+        this->walk_path(j, regs[ip->dst], ip->b, ip->c != 0, ip->dst);
+        VM_NEXT;
+    }
+
+    VM_OP(RETURN)
+    return &regs[ip->a];
+
+    VM_END
+
+#undef VM_LOAD
+}
+
+// same as run() for programs where every value is a number: no variants, no conversions
+num_t eval_context::run_numeric()
+{
+    num_t *regs = this->num_registers_.data();
+    const slot_binding_t *slots = this->slots_.data();
+    const instruction_t *code = this->compiled_->program_.code.data();
+    const instruction_t *ip = code;
+
+#define VM_SLOT(s) (*static_cast<const num_t *>(slots[s].ptr))
+
+    VM_BEGIN
+
+    VM_OP(LOAD_VAR)
+    regs[ip->dst] = VM_SLOT(ip->a);
+    VM_NEXT;
+    VM_OP(LOAD_VAR2)
+    regs[ip->dst] = VM_SLOT(ip->a);
+    regs[ip->dst + 1] = VM_SLOT(ip->b);
+    VM_NEXT;
+    VM_OP(LOAD_VAR3)
+    regs[ip->dst] = VM_SLOT(ip->a);
+    regs[ip->dst + 1] = VM_SLOT(ip->b);
+    regs[ip->dst + 2] = VM_SLOT(ip->c);
+    VM_NEXT;
+    VM_OP(MOVE)
+    regs[ip->dst] = regs[ip->a];
+    VM_NEXT;
+    VM_OP(CALL_M)
+    regs[ip->dst] = this->compiled_->program_.m_functions[ip->c].func(regs + ip->a);
+    VM_NEXT;
+
+    VM_OP(JUMP)
+    VM_GOTO(ip->c);
+    VM_OP(JUMP_IF_FALSE)
+    if (regs[ip->a] == 0)
+    {
+        VM_GOTO(ip->c);
+    }
+    VM_NEXT;
+    VM_OP(AND_JUMP)
+    if (regs[ip->a] == 0)
+    {
+        regs[ip->dst] = 0;
+        VM_GOTO(ip->c);
+    }
+    VM_NEXT;
+    VM_OP(OR_JUMP)
+    if (regs[ip->a] != 0)
+    {
+        regs[ip->dst] = regs[ip->a];
+        VM_GOTO(ip->c);
+    }
+    VM_NEXT;
+
+    VM_OP(ADD)
+    regs[ip->dst] = regs[ip->a] + regs[ip->b];
+    VM_NEXT;
+    VM_OP(SUB)
+    regs[ip->dst] = regs[ip->a] - regs[ip->b];
+    VM_NEXT;
+    VM_OP(MUL)
+    regs[ip->dst] = regs[ip->a] * regs[ip->b];
+    VM_NEXT;
+    VM_OP(DIV)
+    regs[ip->dst] = regs[ip->a] / regs[ip->b];
+    VM_NEXT;
+    VM_OP(MOD)
+    regs[ip->dst] = std::fmod(regs[ip->a], regs[ip->b]);
+    VM_NEXT;
+    VM_OP(POW)
+    regs[ip->dst] = std::pow(regs[ip->a], regs[ip->b]);
+    VM_NEXT;
+    VM_OP(EQ)
+    regs[ip->dst] = regs[ip->a] == regs[ip->b];
+    VM_NEXT;
+    VM_OP(NEQ)
+    regs[ip->dst] = regs[ip->a] != regs[ip->b];
+    VM_NEXT;
+    VM_OP(LT)
+    regs[ip->dst] = regs[ip->a] < regs[ip->b];
+    VM_NEXT;
+    VM_OP(LTE)
+    regs[ip->dst] = regs[ip->a] <= regs[ip->b];
+    VM_NEXT;
+    VM_OP(GT)
+    regs[ip->dst] = regs[ip->a] > regs[ip->b];
+    VM_NEXT;
+    VM_OP(GTE)
+    regs[ip->dst] = regs[ip->a] >= regs[ip->b];
+    VM_NEXT;
+    VM_OP(NOT)
+    regs[ip->dst] = regs[ip->a] == 0;
+    VM_NEXT;
+
+    VM_OP(MUL_ADD)
+    {
+        // two roundings like MUL and ADD, the result does not depend on the FMA support of the machine
+        num_t product = regs[ip->a] * regs[ip->b];
+        regs[ip->dst] = product + regs[ip->c];
+        VM_NEXT;
+    }
+    VM_OP(BINARY_VAR)
+    regs[ip->dst] = binary_numbers(static_cast<opcode>(ip->c), VM_SLOT(ip->a), regs[ip->b]);
+    VM_NEXT;
+
+    VM_OP(RETURN)
+    return regs[ip->a];
+
+    VM_OP(CALL_F)
+    VM_OP(CALL_A)
+    VM_OP(AND)
+    VM_OP(OR)
+    VM_OP(LOAD_REF)
+    VM_OP(ACCESS)
+    VM_OP(INDEX)
+    VM_OP(ACCESS_REF)
+    VM_OP(INDEX_REF)
+    VM_OP(PATH)
+    VM_OP(ACCESS_VAR)
+    VM_OP(PATH_VAR)
+    throw std::runtime_error("Invalid instruction in numeric program");
+
+    VM_END
+
+#undef VM_SLOT
+}
+
+#pragma endregion
+
+#pragma region batch
+
+static void store_result(const token_data_t &value, num_t &out)
+{
+    out = parser_dtype{value}.toNumber();
+}
+
+static void store_result(const token_data_t &value, token_data_t &out)
+{
+    out = value;
+}
+
+static const void *column_row(const column_t &column, size_t row)
+{
+    switch (column.kind)
+    {
+    case binding_kind::NUMBER:
+        return static_cast<const num_t *>(column.data) + row;
+    case binding_kind::STRING:
+        return static_cast<const string_t *>(column.data) + row;
+    case binding_kind::JSON:
+        return static_cast<const json_t *>(column.data) + row;
+    default:
+        return static_cast<const token_data_t *>(column.data) + row;
+    }
+}
+
+void eval_context::eval_batch(const columns_t &columns, size_t n_rows, num_t *out)
+{
+    this->eval_rows(columns, 0, n_rows, out);
+}
+
+void eval_context::eval_batch(const columns_t &columns, size_t n_rows, token_data_t *out)
+{
+    this->eval_rows(columns, 0, n_rows, out);
+}
+
+// rows first_row to end_row - 1, row i is written to out[i]
+template <typename out_t>
+void eval_context::eval_rows(const columns_t &columns, size_t first_row, size_t end_row, out_t *out)
+{
+    if (!this->compiled_ || this->compiled_->program_.empty())
+        throw std::runtime_error("Expression is not compiled");
+    const auto &program = this->compiled_->program_;
+
+    // slot i reads column_of[i] when it has a column, otherwise its binding. The vectors of a
+    // call are kept in the context, they are reused by the next one
+    auto &column_of = this->batch_columns_;
+    column_of.assign(program.names.size(), nullptr);
+    bool all_numbers = program.numeric_code;
+    for (size_t i = 0; i < program.names.size(); i++)
+    {
+        auto column = columns.find(program.names[i]);
+        if (column != columns.end() && column->second.kind != binding_kind::NONE)
+            column_of[i] = &column->second;
+        const auto kind = column_of[i] ? column_of[i]->kind : this->slots_[i].kind;
+        if (program.slot_types[i] != binding_kind::NONE && kind != program.slot_types[i])
+        {
+            throw std::runtime_error(column_of[i] ? "Variable " + program.names[i] + " was compiled for another type"
+                                                  : "Undefined variable: " + program.names[i]);
+        }
+        all_numbers = all_numbers && kind == binding_kind::NUMBER;
+    }
+
+    if (all_numbers)
+    {
+        // vector at a time: a column is read with stride 1, a number bound to the context with stride 0
+        auto &bases = this->batch_bases_;
+        auto &strides = this->batch_strides_;
+        bases.resize(program.names.size());
+        strides.resize(program.names.size());
+        for (size_t i = 0; i < program.names.size(); i++)
+        {
+            bases[i] = static_cast<const num_t *>(column_of[i] ? column_of[i]->data : this->slots_[i].ptr);
+            strides[i] = column_of[i] ? 1 : 0;
+        }
+
+        // constants are broadcast once, the temporaries are overwritten by every block
+        this->lanes_.resize(static_cast<size_t>(program.num_registers) * batch_block_rows);
+        this->resume_.resize(batch_block_rows);
+        for (size_t r = 0; r < program.num_constants.size(); r++)
+            std::fill_n(this->lanes_.begin() + r * batch_block_rows, batch_block_rows, program.num_constants[r]);
+
+        num_t block[batch_block_rows];
+        for (size_t first = first_row; first < end_row; first += batch_block_rows)
+        {
+            const size_t n = std::min(batch_block_rows, end_row - first);
+            if constexpr (std::is_same<out_t, num_t>::value)
+            {
+                this->run_block(bases.data(), strides.data(), first, n, out + first);
+            }
+            else
+            {
+                this->run_block(bases.data(), strides.data(), first, n, block);
+                std::copy(block, block + n, out + first);
+            }
+        }
+        return;
+    }
+
+    // row at a time: the slots with a column point to the row, the bindings are restored afterwards
+    auto &saved = this->batch_saved_slots_;
+    saved.assign(this->slots_.begin(), this->slots_.end());
+    try
+    {
+        for (size_t row = first_row; row < end_row; row++)
+        {
+            for (size_t i = 0; i < column_of.size(); i++)
+            {
+                if (column_of[i])
+                    this->slots_[i] = {column_of[i]->kind, column_row(*column_of[i], row)};
+            }
+            store_result(*this->run(), out[row]);
+        }
+    }
+    catch (...)
+    {
+        this->slots_ = saved;
+        throw;
+    }
+    this->slots_ = saved;
+}
+
+// Vectorized interpreter for numeric code, each instruction runs over the rows of the block.
+// Jumps only go forward: a row that jumps is skipped until the target, it runs again from
+// resume_[row]. Without pending jumps the lane loops have no condition and can be vectorized
+void eval_context::run_block(const num_t *const *bases, const size_t *strides, size_t first_row, size_t n, num_t *out)
+{
+    const auto &program = this->compiled_->program_;
+    const auto &code = program.code;
+    num_t *lanes = this->lanes_.data();
+    uint32_t *resume = this->resume_.data();
+    std::fill_n(resume, n, 0);
+    bool masked = false;
+    uint32_t pc = 0;
+
+    auto reg = [&](uint32_t r)
+    { return lanes + static_cast<size_t>(r) * batch_block_rows; };
+    auto for_rows = [&](auto &&f)
+    {
+        if (masked)
+        {
+            for (size_t l = 0; l < n; l++)
+            {
+                if (resume[l] <= pc)
+                    f(l);
+            }
+        }
+        else
+        {
+            for (size_t l = 0; l < n; l++)
+                f(l);
+        }
+    };
+    auto load = [&](num_t *d, uint32_t slot)
+    {
+        const num_t *src = bases[slot] + first_row * strides[slot];
+        if (strides[slot] == 0)
+            for_rows([&](size_t l)
+                     { d[l] = *src; });
+        else
+            for_rows([&](size_t l)
+                     { d[l] = src[l]; });
+    };
+    // kernels compute every row into scratch, their output can not be one of the arguments (the
+    // result of CALL_M goes to its first argument) and the rows that jumped keep their value
+    static const m_column_function pow_kernel = simd_builtins::pow_kernel();
+    num_t scratch[batch_block_rows];
+    auto column = [&](m_column_function kernel, const num_t *const *args, num_t *d)
+    {
+        kernel(args, scratch, n);
+        for_rows([&](size_t l)
+                 { d[l] = scratch[l]; });
+    };
+    auto binary = [&](opcode op, num_t *d, const num_t *a, const num_t *b)
+    {
+        switch (op)
+        {
+        case opcode::ADD:
+            for_rows([&](size_t l)
+                     { d[l] = a[l] + b[l]; });
+            break;
+        case opcode::SUB:
+            for_rows([&](size_t l)
+                     { d[l] = a[l] - b[l]; });
+            break;
+        case opcode::MUL:
+            for_rows([&](size_t l)
+                     { d[l] = a[l] * b[l]; });
+            break;
+        case opcode::DIV:
+            for_rows([&](size_t l)
+                     { d[l] = a[l] / b[l]; });
+            break;
+        case opcode::MOD:
+            for_rows([&](size_t l)
+                     { d[l] = std::fmod(a[l], b[l]); });
+            break;
+        case opcode::POW:
+            if (pow_kernel)
+            {
+                const num_t *args[] = {a, b};
+                column(pow_kernel, args, d);
+            }
+            else
+                for_rows([&](size_t l)
+                         { d[l] = std::pow(a[l], b[l]); });
+            break;
+        case opcode::EQ:
+            for_rows([&](size_t l)
+                     { d[l] = a[l] == b[l]; });
+            break;
+        case opcode::NEQ:
+            for_rows([&](size_t l)
+                     { d[l] = a[l] != b[l]; });
+            break;
+        case opcode::LT:
+            for_rows([&](size_t l)
+                     { d[l] = a[l] < b[l]; });
+            break;
+        case opcode::LTE:
+            for_rows([&](size_t l)
+                     { d[l] = a[l] <= b[l]; });
+            break;
+        case opcode::GT:
+            for_rows([&](size_t l)
+                     { d[l] = a[l] > b[l]; });
+            break;
+        default:
+            for_rows([&](size_t l)
+                     { d[l] = a[l] >= b[l]; });
+            break;
+        }
+    };
+
+    for (; pc < code.size(); pc++)
+    {
+        const auto &ins = code[pc];
+        if (masked)
+            masked = std::any_of(resume, resume + n, [&](uint32_t target)
+                                 { return target > pc; });
+        num_t *d = reg(ins.dst);
+        const num_t *a = reg(ins.a), *b = reg(ins.b);
+
+        switch (ins.op)
+        {
+        case opcode::LOAD_VAR:
+            load(d, ins.a);
+            break;
+        case opcode::LOAD_VAR2:
+            load(d, ins.a);
+            load(reg(ins.dst + 1), ins.b);
+            break;
+        case opcode::LOAD_VAR3:
+            load(d, ins.a);
+            load(reg(ins.dst + 1), ins.b);
+            load(reg(ins.dst + 2), ins.c);
+            break;
+        case opcode::MOVE:
+            for_rows([&](size_t l)
+                     { d[l] = a[l]; });
+            break;
+        case opcode::CALL_M:
+        {
+            if (const auto kernel = program.m_kernels[ins.c])
+            {
+                const num_t *args[max_m_function_args];
+                for (uint32_t k = 0; k < ins.b; k++)
+                    args[k] = reg(ins.a + k);
+                column(kernel, args, d);
+                break;
+            }
+            const auto func = program.m_functions[ins.c].func;
+            for_rows([&](size_t l)
+                     {
+                num_t args[max_m_function_args];
+                for (uint32_t k = 0; k < ins.b; k++)
+                    args[k] = reg(ins.a + k)[l];
+                d[l] = func(args); });
+            break;
+        }
+
+        case opcode::JUMP:
+        case opcode::JUMP_IF_FALSE:
+        case opcode::AND_JUMP:
+        case opcode::OR_JUMP:
+        {
+            if (ins.op == opcode::JUMP)
+                for_rows([&](size_t l)
+                         { resume[l] = ins.c; });
+            else if (ins.op == opcode::JUMP_IF_FALSE)
+                for_rows([&](size_t l)
+                         { if (a[l] == 0) resume[l] = ins.c; });
+            else if (ins.op == opcode::AND_JUMP)
+                for_rows([&](size_t l)
+                         { if (a[l] == 0) { d[l] = 0; resume[l] = ins.c; } });
+            else
+                for_rows([&](size_t l)
+                         { if (a[l] != 0) { d[l] = a[l]; resume[l] = ins.c; } });
+
+            // continue at the first instruction some row runs
+            uint32_t next = ins.c;
+            for (size_t l = 0; l < n; l++)
+                next = std::min(next, std::max(resume[l], pc + 1));
+            pc = next - 1;
+            masked = true;
+            break;
+        }
+
+        case opcode::ADD:
+        case opcode::SUB:
+        case opcode::MUL:
+        case opcode::DIV:
+        case opcode::MOD:
+        case opcode::POW:
+        case opcode::EQ:
+        case opcode::NEQ:
+        case opcode::LT:
+        case opcode::LTE:
+        case opcode::GT:
+        case opcode::GTE:
+            binary(ins.op, d, a, b);
+            break;
+        case opcode::NOT:
+            for_rows([&](size_t l)
+                     { d[l] = a[l] == 0; });
+            break;
+
+        case opcode::MUL_ADD:
+        {
+            const num_t *c = reg(ins.c);
+            for_rows([&](size_t l)
+                     {
+                num_t product = a[l] * b[l];
+                d[l] = product + c[l]; });
+            break;
+        }
+        case opcode::BINARY_VAR:
+            // dst is free until the result is written, the variable is loaded there
+            load(d, ins.a);
+            binary(static_cast<opcode>(ins.c), d, d, b);
+            break;
+
+        case opcode::RETURN:
+            // every row that jumped resumed at or before the last instruction
+            std::copy(a, a + n, out);
+            return;
+
+        default:
+            throw std::runtime_error("Invalid instruction in numeric program");
+        }
+    }
+}
+
+void eval_batch(const compiled_expr_ptr &compiled, const columns_t &columns, size_t n_rows, num_t *out)
+{
+    eval_context context(compiled);
+    context.eval_batch(columns, n_rows, out);
+}
+
+void eval_batch(const compiled_expr_ptr &compiled, const columns_t &columns, size_t n_rows, token_data_t *out)
+{
+    eval_context context(compiled);
+    context.eval_batch(columns, n_rows, out);
+}
+
+#pragma endregion
+
+#pragma region optimizer
+
+// Type inference, the type a node has whatever its operands hold at eval time:
+//  - literals have their own type, variables the type of their binding (NUMBER or STRING)
+//  - numeric builtins return numbers, generic builtins their declared type, user functions ANY
+//  - operators follow the rules of operators_builtins, e.g. string + number is a string
+value_type expr::infer_type(const ast_node_t &node) const
+{
+    switch (node.type)
+    {
+    case token_types::LITERAL:
+        return static_cast<value_type>(node.value.index() + 1);
+
+    case token_types::VARIABLE:
+    {
+        auto binding = this->bindings_.find(std::get<string_t>(node.value));
+        if (binding == this->bindings_.end())
+            return value_type::ANY;
+        if (binding->second.kind == binding_kind::NUMBER)
+            return value_type::NUMBER;
+        if (binding->second.kind == binding_kind::STRING)
+            return value_type::STRING;
+        // json values are converted when loaded, so they can be anything
+        return value_type::ANY;
+    }
+
+    case token_types::FUNCTION:
+    {
+        const auto &name = std::get<string_t>(node.value);
+        if (name == "if")
+        {
+            auto a = this->infer_type(*node.args[1]);
+            return a == this->infer_type(*node.args[2]) ? a : value_type::ANY;
+        }
+        if (m_parser_builtins::f.count(name))
+            return value_type::NUMBER;
+        auto type = f_parser_builtins::return_types.find(name);
+        return type != f_parser_builtins::return_types.end() ? type->second : value_type::ANY;
+    }
+
+    case token_types::OPERATOR:
+    {
+        auto op = operator_opcodes_.at(std::get<string_t>(node.value));
+        if (op == opcode::ACCESS)
+            return value_type::ANY;
+
+        auto a = this->infer_type(*node.args[0]);
+        auto b = node.args.size() > 1 ? this->infer_type(*node.args[1]) : a;
+        switch (op)
+        {
+        case opcode::ADD:
+            if (a == value_type::NUMBER && b == value_type::NUMBER)
+                return value_type::NUMBER;
+            if ((a == value_type::STRING || a == value_type::NUMBER) && (b == value_type::STRING || b == value_type::NUMBER))
+                return value_type::STRING;
+            return value_type::ANY;
+        case opcode::MUL:
+            if ((a == value_type::NUMBER && b == value_type::STRING) || (a == value_type::STRING && b == value_type::NUMBER))
+                return value_type::STRING;
+            if ((a == value_type::NUMBER || a == value_type::STRING) && (b == value_type::NUMBER || b == value_type::STRING))
+                return value_type::NUMBER;
+            return value_type::ANY;
+        case opcode::AND:
+        case opcode::OR:
+            return a == b ? a : value_type::ANY;
+        case opcode::INDEX:
+            return a == value_type::STRING && b == value_type::NUMBER ? value_type::STRING : value_type::ANY;
+        default:
+            return value_type::NUMBER;
+        }
+    }
+
+    default:
+        return value_type::ANY;
+    }
+}
+
+bool expr::is_numeric(const ast_node_t &node) const
+{
+    return this->infer_type(node) == value_type::NUMBER;
+}
+
+// true when every node of the tree is a number, the program can then run on plain num_t registers
+bool expr::is_numeric_only(const ast_node_t &node) const
+{
+    if (node.type == token_types::FUNCTION && !m_parser_builtins::f.count(std::get<string_t>(node.value)) &&
+        std::get<string_t>(node.value) != "if")
+        return false;
+    if (!this->is_numeric(node))
+        return false;
+    return std::all_of(node.args.begin(), node.args.end(), [this](const ast_ptr_t &arg)
+                       { return this->is_numeric_only(*arg); });
+}
+
+// evaluate a node whose arguments are all literals, returns false if it can not be done at compile time
+bool expr::fold(const ast_node_t &node, token_data_t &result) const
+{
+    std::vector<token_data_t> args;
+    for (const auto &arg : node.args)
+        args.push_back(arg->value);
+
+    const auto &name = std::get<string_t>(node.value);
+    try
+    {
+        if (node.type == token_types::FUNCTION)
+        {
+            auto func_m = m_parser_builtins::f.find(name);
+            if (func_m != m_parser_builtins::f.end())
+            {
+                num_t m_args[max_m_function_args];
+                for (size_t i = 0; i < args.size(); i++)
+                    m_args[i] = m_parser_builtins::m_argument_to_number(args[i]);
+                result = func_m->second.func(m_args);
+                return true;
+            }
+
+            // user functions may not be pure, only builtins are folded
+            auto func_f = f_parser_builtins::f.find(name);
+            if (func_f == f_parser_builtins::f.end())
+                return false;
+            result = func_f->second.func(args.data());
+            return true;
+        }
+
+        const auto &a = args[0];
+        const auto &b = args.size() > 1 ? args[1] : args[0];
+        switch (operator_opcodes_.at(name))
+        {
+        case opcode::ADD:
+            result = operators_builtins::add_f(a, b);
+            break;
+        case opcode::SUB:
+            result = operators_builtins::sub_f(a, b);
+            break;
+        case opcode::MUL:
+            result = operators_builtins::mult_f(a, b);
+            break;
+        case opcode::DIV:
+            result = operators_builtins::div_f(a, b);
+            break;
+        case opcode::MOD:
+            result = operators_builtins::mod_f(a, b);
+            break;
+        case opcode::POW:
+            result = operators_builtins::pow_f(a, b);
+            break;
+        case opcode::EQ:
+            result = operators_builtins::eq_f(a, b);
+            break;
+        case opcode::NEQ:
+            result = operators_builtins::neq_f(a, b);
+            break;
+        case opcode::LT:
+            result = operators_builtins::lt_f(a, b);
+            break;
+        case opcode::LTE:
+            result = operators_builtins::lte_f(a, b);
+            break;
+        case opcode::GT:
+            result = operators_builtins::gt_f(a, b);
+            break;
+        case opcode::GTE:
+            result = operators_builtins::gte_f(a, b);
+            break;
+        case opcode::AND:
+            result = operators_builtins::and_f(a, b);
+            break;
+        case opcode::OR:
+            result = operators_builtins::or_f(a, b);
+            break;
+        case opcode::NOT:
+            result = operators_builtins::not_f(a);
+            break;
+        case opcode::ACCESS:
+            result = operators_builtins::access_f(a, b);
+            break;
+        case opcode::INDEX:
+            result = operators_builtins::index_f(a, b);
+            break;
+        default:
+            return false;
+        }
+        return true;
+    }
+    catch (const std::exception &)
+    {
+        // leave it to eval, which reports the error
+        return false;
+    }
+}
+
+// Optimization pass over the tree, bottom up:
+// 0. Select the branch of if(), && and || when the condition is a literal
+// 1. Fold operators and builtin calls whose arguments are all literals
+// 2. Rewrite the numeric identities that hold for every double:
+//    x * 1, 1 * x, x / 1, x - 0, x ^ 1, pow(x, 1) => x
+// x must be numeric for 2, the operators do other things on strings and json values
+void expr::simplify(ast_ptr_t &node) const
+{
+    for (auto &arg : node->args)
+        this->simplify(arg);
+
+    if (node->type != token_types::OPERATOR && node->type != token_types::FUNCTION)
+        return;
+
+    // a constant condition selects the branch at compile time
+    const auto &first = node->args.empty() ? node : node->args[0];
+    if (first->type == token_types::LITERAL && node->type == token_types::FUNCTION &&
+        std::get<string_t>(node->value) == "if")
+    {
+        auto branch = std::move(node->args[operators_builtins::truthy_f(first->value) ? 1 : 2]);
+        node = std::move(branch);
+        return;
+    }
+    if (first->type == token_types::LITERAL && node->type == token_types::OPERATOR &&
+        (std::get<string_t>(node->value) == "&&" || std::get<string_t>(node->value) == "||"))
+    {
+        bool truthy = operators_builtins::truthy_f(first->value);
+        if (std::get<string_t>(node->value) == "&&")
+        {
+            if (truthy)
+            {
+                auto rhs = std::move(node->args[1]);
+                node = std::move(rhs);
+            }
+            else
+                node = std::make_unique<ast_node_t>(token_types::LITERAL, operators_builtins::falsy_f(first->value));
+        }
+        else
+        {
+            auto kept = std::move(node->args[truthy ? 0 : 1]);
+            node = std::move(kept);
+        }
+        return;
+    }
+
+    if (std::all_of(node->args.begin(), node->args.end(), [](const ast_ptr_t &arg)
+                    { return arg->type == token_types::LITERAL; }))
+    {
+        token_data_t result;
+        if (this->fold(*node, result))
+        {
+            node = std::make_unique<ast_node_t>(token_types::LITERAL, std::move(result));
+            return;
+        }
+    }
+
+    if (node->args.size() != 2)
+        return;
+
+    const auto &name = std::get<string_t>(node->value);
+    auto is_number = [](const ast_ptr_t &arg, num_t value)
+    {
+        return arg->type == token_types::LITERAL && arg->value.index() == 0 && std::get<num_t>(arg->value) == value;
+    };
+
+    opcode op;
+    if (node->type == token_types::FUNCTION)
+    {
+        if (name != "pow")
+            return;
+        op = opcode::POW;
+    }
+    else
+    {
+        op = operator_opcodes_.at(name);
+    }
+
+    auto &lhs = node->args[0];
+    auto &rhs = node->args[1];
+
+    if (!this->is_numeric(*lhs) || !this->is_numeric(*rhs))
+        return;
+
+    // only the identities that hold for every double, including -0, infinities and NaN. x + 0 is not
+    // one (-0 + 0 is +0), and neither are x - -0, x ^ 0.5 -> sqrt(x) (pow(-0, 0.5) is +0 and
+    // pow(-inf, 0.5) is +inf) or x ^ 2 -> x * x (pow is not always correctly rounded)
+    auto is_positive_zero = [&is_number](const ast_ptr_t &arg)
+    {
+        return is_number(arg, 0) && !std::signbit(std::get<num_t>(arg->value));
+    };
+    if (((op == opcode::MUL || op == opcode::DIV || op == opcode::POW) && is_number(rhs, 1)) ||
+        (op == opcode::SUB && is_positive_zero(rhs)))
+    {
+        auto x = std::move(lhs);
+        node = std::move(x);
+    }
+    else if (op == opcode::MUL && is_number(lhs, 1))
+    {
+        auto x = std::move(rhs);
+        node = std::move(x);
+    }
+}
+
+#pragma endregion
+
+#pragma region bindings
+
+// point every slot of the program to its storage, explicit bindings first and then set_variables
+// values (unordered_map nodes are stable, so the pointers stay valid while the variable exists)
+void expr::bind_slots()
+{
+    const auto &names = this->compiled_->program_.names;
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        auto binding = this->bindings_.find(names[i]);
+        if (binding != this->bindings_.end())
+        {
+            this->context_.set_slot(i, binding->second);
+            continue;
+        }
+
+        auto var = this->variables_.find(names[i]);
+        if (var != this->variables_.end())
+            this->context_.set_slot(i, {binding_kind::VALUE, &var->second});
+        else
+            this->context_.set_slot(i, slot_binding_t());
+    }
+}
+
+void expr::bind(const string_t &name, binding_kind kind, const void *ptr)
+{
+    // binding anything else releases the shared document
+    auto shared = this->shared_values_.find(name);
+    if (shared != this->shared_values_.end() && shared->second.get() != ptr)
+        this->shared_values_.erase(shared);
+
+    if (kind == binding_kind::NONE || ptr == nullptr)
+    {
+        kind = binding_kind::NONE;
+        this->bindings_.erase(name);
+    }
+    else
+    {
+        this->bindings_[name] = {kind, ptr};
+    }
+
+    // the program was compiled for the type that was bound to this slot
+    const auto &program = this->compiled_->program_;
+    auto slot = std::find(program.names.begin(), program.names.end(), name);
+    if (slot != program.names.end() && program.slot_types[slot - program.names.begin()] != binding_kind::NONE &&
+        program.slot_types[slot - program.names.begin()] != kind)
+    {
+        this->compile();
+        return;
+    }
+    this->bind_slots();
+}
+
+void eval_context::set_slot(size_t slot_index, slot_binding_t binding)
+{
+    this->slots_[slot_index] = binding;
+    this->slots_checked_ = false;
+    // anything bound over a shared document releases it
+    if (!this->shared_.empty())
+        this->shared_[slot_index].reset();
+}
+
+// the code of a slot the program was optimized for reads it without checking its type.
+// Returns the first slot that is not bound to that type, or the number of slots
+size_t eval_context::mismatched_slot() const noexcept
+{
+    const auto &program = this->compiled_->program_;
+    for (size_t i = 0; i < this->slots_.size(); i++)
+    {
+        if (program.slot_types[i] != binding_kind::NONE && this->slots_[i].kind != program.slot_types[i])
+            return i;
+    }
+    return this->slots_.size();
+}
+
+void eval_context::check_slots()
+{
+    const auto &program = this->compiled_->program_;
+    const size_t slot = this->mismatched_slot();
+    if (slot < this->slots_.size())
+        throw std::runtime_error("Undefined variable: " + program.names[slot]);
+    // numeric code runs over num_t registers when every variable is a number
+    this->numeric_slots_ = program.numeric_code && std::all_of(this->slots_.begin(), this->slots_.end(), [](const slot_binding_t &slot)
+                                                               { return slot.kind == binding_kind::NUMBER; });
+    this->slots_checked_ = true;
+}
+
+// returns the slot of the variable, or the number of slots when the expression does not use it
+size_t eval_context::bind(const string_t &name, binding_kind kind, const void *ptr)
+{
+    if (!this->compiled_)
+        throw std::runtime_error("Expression is not compiled");
+    if (ptr == nullptr)
+        kind = binding_kind::NONE;
+
+    const auto &program = this->compiled_->program_;
+    auto slot = std::find(program.names.begin(), program.names.end(), name);
+    if (slot == program.names.end())
+        return program.names.size(); // not used by the expression
+    const size_t slot_index = slot - program.names.begin();
+    if (kind != binding_kind::NONE && program.slot_types[slot_index] != binding_kind::NONE && program.slot_types[slot_index] != kind)
+        throw std::runtime_error("Variable " + name + " was compiled for another type");
+    this->set_slot(slot_index, {kind, ptr});
+    return slot_index;
+}
+
+void eval_context::bind(const string_t &name, shared_json_t value)
+{
+    const size_t slot_index = this->bind(name, binding_kind::JSON, value.get());
+    if (slot_index == this->slots_.size() || !value)
+        return;
+    this->shared_.resize(this->slots_.size());
+    this->shared_[slot_index] = std::move(value);
+}
+
+void eval_context::set_variables(const std::unordered_map<string_t, token_data_t> &variables)
+{
+    if (!this->compiled_)
+        throw std::runtime_error("Expression is not compiled");
+
+    const auto &program = this->compiled_->program_;
+    for (const auto &variable : variables)
+    {
+        auto slot = std::find(program.names.begin(), program.names.end(), variable.first);
+        if (slot == program.names.end())
+            continue;
+        const size_t slot_index = slot - program.names.begin();
+
+        auto &value = this->values_[slot_index];
+        value = variable.second;
+        json_to_correct_dtype(value);
+
+        // a slot the program was optimized for points to the number or string inside the value
+        const auto type = program.slot_types[slot_index];
+        if (type == binding_kind::NONE)
+            this->set_slot(slot_index, {binding_kind::VALUE, &value});
+        else if (type == binding_kind::NUMBER && std::holds_alternative<num_t>(value))
+            this->set_slot(slot_index, {type, &std::get<num_t>(value)});
+        else if (type == binding_kind::STRING && std::holds_alternative<string_t>(value))
+            this->set_slot(slot_index, {type, &std::get<string_t>(value)});
+        else
+            throw std::runtime_error("Variable " + variable.first + " was compiled for another type");
+    }
+}
+
+#pragma endregion
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <iostream>
+#include <algorithm>
 #include <vector>
 #include <string>
 #include <regex>
@@ -14,7 +15,11 @@
 #include "json.hpp"
 #include "tools.h"
 #include "my_expr_dtypes.h"
+#include "my_expr_error.h"
 #include "my_expr_functions.hpp"
+#include "my_expr_bytecode.h"
+#include "my_expr_jit.h"
+#include "my_expr_aot.h"
 
 // create token struct
 
@@ -135,37 +140,247 @@ public:
 	}
 };
 
+// what a compiled expression reads and calls, known before it is evaluated
+struct expr_dependencies
+{
+	// value read from a variable, see program_t::json_paths
+	struct path_t
+	{
+		string_t variable;
+		std::vector<token_data_t> keys; // string keys are . and number keys are []
+		bool dynamic = false;			// the element is also read with a key computed at run time
+
+		// variable.key[0]..., as written in an expression
+		string_t to_string() const;
+	};
+
+	std::vector<string_t> variables;
+	std::vector<string_t> builtin_functions;
+	std::vector<string_t> user_functions; // set_functions and asynchronous functions
+	std::vector<path_t> paths;
+	bool dynamic_access = false; // one of the paths is dynamic
+};
+
+// Compiled program of an expression. It is never modified once created, so one instance can be
+// shared through a shared_ptr and evaluated from many threads, each with its own eval_context
+class compiled_expr
+{
+public:
+	const string_t &expression() const noexcept { return expression_; }
+	const program_t &program() const noexcept { return program_; }
+	bool is_native() const noexcept { return native_entry_ != nullptr; }
+	expr_dependencies dependencies() const;
+
+private:
+	string_t expression_;
+	program_t program_;
+	native_entry_t native_entry_ = nullptr;
+	std::shared_ptr<const void> native_code_; // keeps the code of native_entry_ loaded
+
+	friend class expr;
+	friend class eval_context;
+};
+
+using compiled_expr_ptr = std::shared_ptr<const compiled_expr>;
+
+// column a variable reads from in a batch evaluation, row i reads data[i]
+struct column_t
+{
+	binding_kind kind = binding_kind::NONE;
+	const void *data = nullptr;
+
+	column_t() = default;
+	column_t(const num_t *values) : kind(binding_kind::NUMBER), data(values) {}
+	column_t(const string_t *values) : kind(binding_kind::STRING), data(values) {}
+	column_t(const json_t *values) : kind(binding_kind::JSON), data(values) {}
+	column_t(const token_data_t *values) : kind(binding_kind::VALUE), data(values) {}
+};
+
+using columns_t = std::unordered_map<string_t, column_t>;
+
+// rows evaluated together by the vectorized interpreter
+constexpr size_t batch_block_rows = 256;
+
+// Mutable state of an evaluation: the register file, the storage every variable slot reads from
+// and the unknown variable resolver. Contexts are cheap to create, one per thread or per request;
+// a context must not be used by two threads at the same time
+class eval_context
+{
+public:
+	eval_context() = default;
+	explicit eval_context(compiled_expr_ptr compiled);
+
+	eval_context(const eval_context &) = delete;
+	eval_context &operator=(const eval_context &) = delete;
+	eval_context(eval_context &&) = default;
+	eval_context &operator=(eval_context &&) = default;
+
+	const compiled_expr_ptr &compiled() const noexcept { return compiled_; }
+
+	// same as expr::bind, but the program can not be recompiled from here: binding a variable that
+	// the program was optimized for (see program_t::slot_types) to another type throws.
+	// bind and set_variables fill the same slots, the last call wins
+	void bind(const string_t &name, const num_t *value) { bind(name, binding_kind::NUMBER, value); }
+	void bind(const string_t &name, const string_t *value) { bind(name, binding_kind::STRING, value); }
+	void bind(const string_t &name, const json_t *value) { bind(name, binding_kind::JSON, value); }
+	void bind(const string_t &name, const token_data_t *value) { bind(name, binding_kind::VALUE, value); }
+	// the context keeps a reference to the document while it is bound
+	void bind(const string_t &name, shared_json_t value);
+	void unbind(const string_t &name) { bind(name, binding_kind::NONE, nullptr); }
+
+	// values are copied into the context
+	void set_variables(const std::unordered_map<string_t, token_data_t> &variables);
+	void set_unknown_var_resolver(function_resolver_t resolver) { unknown_var_resolver_ = std::move(resolver); }
+	// unknown variables of eval_async() are awaited from this resolver, eval() still uses the one above
+	void set_async_var_resolver(async_resolver_t resolver) { async_var_resolver_ = std::move(resolver); }
+
+	parser_dtype eval();
+	// same as eval(), errors are returned with their code and position instead of thrown. A variable
+	// left undefined is found without throwing, exceptions of user functions and resolvers are caught
+	expr_result<parser_dtype> try_eval() noexcept;
+
+	// same as eval(), suspended while an unknown variable or an asynchronous function is awaited.
+	// Values resolved asynchronously are kept until the evaluation finishes, the next one asks for
+	// them again. The context must not be moved, used or destroyed while the task is running
+	eval_task<parser_dtype> eval_async();
+
+	// evaluate n_rows rows, the variables with a column read row i from it and the rest keep their
+	// binding. When every value is a number, each instruction runs over a block of rows at a time,
+	// otherwise the rows are evaluated one by one. The num_t overload converts the results like
+	// parser_dtype::toNumber()
+	void eval_batch(const columns_t &columns, size_t n_rows, num_t *out);
+	void eval_batch(const columns_t &columns, size_t n_rows, token_data_t *out);
+
+private:
+	compiled_expr_ptr compiled_;
+	std::vector<token_data_t> registers_;
+	std::vector<num_t> num_registers_;
+	std::vector<const json_t *> refs_; // ref[r] of the path steps, points into a bound json or into a register
+	std::vector<slot_binding_t> slots_;
+	std::vector<token_data_t> values_; // set_variables storage, one per slot
+	std::vector<shared_json_t> shared_; // documents bound to the slots, empty until one is bound
+	function_resolver_t unknown_var_resolver_;
+	async_resolver_t async_var_resolver_;
+	bool awaiting_ = false; // in eval_async(), run() stops at what has to be awaited
+	bool no_throw_ = false; // in try_eval(), run() stops at an error with its code in fault_
+	expr_errc fault_ = expr_errc::OK;
+	uint32_t await_pc_ = 0;
+	uint32_t await_slot_ = 0;
+	bool slots_checked_ = false;
+	bool numeric_slots_ = false; // numeric code with every slot bound to a number
+	std::vector<num_t> lanes_; // batch registers, batch_block_rows values per register
+	std::vector<uint32_t> resume_; // per row of a block, first instruction it runs again after a jump
+	std::vector<const column_t *> batch_columns_; // column of every slot in eval_rows(), nullptr if it has none
+	std::vector<const num_t *> batch_bases_;
+	std::vector<size_t> batch_strides_;
+	std::vector<slot_binding_t> batch_saved_slots_; // bindings restored after a row by row batch
+
+	void reset(compiled_expr_ptr compiled);
+	void release();
+	size_t bind(const string_t &name, binding_kind kind, const void *ptr);
+	void set_slot(size_t slot_index, slot_binding_t binding);
+	size_t mismatched_slot() const noexcept;
+	void check_slots();
+	bool load_variable(uint32_t slot_index, token_data_t &reg);
+	const json_t *bound_json(uint32_t slot_index) const;
+	void step_ref(const json_t *base, const token_data_t &operand, const token_data_t &key, bool index, uint32_t dst);
+	void walk_path(const json_t *base, const token_data_t &operand, uint32_t path, bool by_ref, uint32_t dst);
+	const token_data_t *run(uint32_t pc = 0);
+	num_t run_numeric();
+	void run_block(const num_t *const *bases, const size_t *strides, size_t first_row, size_t n_rows, num_t *out);
+	template <typename out_t>
+	void eval_rows(const columns_t &columns, size_t first_row, size_t end_row, out_t *out);
+
+	friend class expr;
+	friend class batch_executor;
+};
+
+// batch evaluation with a temporary context
+void eval_batch(const compiled_expr_ptr &compiled, const columns_t &columns, size_t n_rows, num_t *out);
+void eval_batch(const compiled_expr_ptr &compiled, const columns_t &columns, size_t n_rows, token_data_t *out);
+
 class expr
 {
 private:
 	string_t expression_;
-	token_stream_t tokens_;
-	token_stream_t output_compiled_;
+	compiled_expr_ptr compiled_ = empty_compiled();
+	eval_context context_; // evaluation state of eval(), the slots point to bindings_ and variables_
+#ifdef EXPR_JIT
+	bool jit_enabled_ = true;
+#else
+	bool jit_enabled_ = false;
+#endif
 
 	std::unordered_map<string_t, token_data_t> variables_;
 	std::unordered_map<string_t, f_function_info> functions_;
+	std::unordered_map<string_t, a_function_info> async_functions_;
+	std::unordered_map<string_t, slot_binding_t> bindings_;
+	std::unordered_map<string_t, shared_json_t> shared_values_; // documents of bind(name, shared_json_t), kept alive while bound
 
 	function_resolver_t unknown_function_resolver_;
-	bool keep_unknown_functions_;
+	bool keep_unknown_functions_ = false;
 	function_resolver_t unknown_var_resolver_;
-	bool keep_unknown_vars_;
+	bool keep_unknown_vars_ = false;
+	async_resolver_t async_var_resolver_;
 
 	void parse();
 	token_stream_t tokenize() const;
 	token_stream_t shunting_yard(const token_stream_t &tokens) const;
-	inline token_data_t evaluate_postfix(const token_stream_t &postfix_tokens) const;
 	token_stream_t token_resolver(const token_stream_t &tokens);
 
+	ast_ptr_t build_ast(const token_stream_t &postfix_tokens) const;
+	callee_t lookup_function(const string_t &name) const;
+	uint32_t name_index(program_t &program, const string_t &name) const;
+	void collect_constants(ast_node_t &node, program_t &program) const;
+	uint32_t lower(const ast_node_t &node, uint32_t depth, program_t &program) const;
+	uint32_t lower_ref(const ast_node_t &node, uint32_t depth, program_t &program) const;
+	bool lower_path(const ast_node_t &node, uint32_t depth, program_t &program, bool by_ref) const;
+	void lower_into(const ast_node_t &node, uint32_t depth, program_t &program) const;
+	void collect_dependencies(const ast_node_t &node, program_t &program) const;
+	program_t generate_program(ast_node_t &root) const;
+	void fuse_instructions(program_t &program) const;
+	value_type infer_type(const ast_node_t &node) const;
+	bool is_numeric(const ast_node_t &node) const;
+	bool is_numeric_only(const ast_node_t &node) const;
+	bool fold(const ast_node_t &node, token_data_t &result) const;
+	void simplify(ast_ptr_t &node) const;
+	void bind_slots();
+	void bind(const string_t &name, binding_kind kind, const void *ptr);
+	void set_native_code(native_entry_t entry, std::shared_ptr<const void> code);
+
+	static const compiled_expr_ptr &empty_compiled();
+	static bool jit_compile(compiled_expr &compiled);
+
+	friend class aot_compiler;
+	friend class expr_cache;
+
 	// Map of operators and their information
 	static const std::unordered_map<string_t, operator_info_t> operator_info_map_;
+	static const std::unordered_map<string_t, opcode> operator_opcodes_;
 	static const std::unordered_set<string_t> operators_;
 	static const std::unordered_set<string_t> literals_;
 
 public:
 	explicit expr(const string_t &exp) : expression_(exp) {};
 
+	expr(const expr &other)
+		: expression_(other.expression_), compiled_(other.compiled_), context_(other.compiled_), jit_enabled_(other.jit_enabled_),
+		  variables_(other.variables_),
+		  functions_(other.functions_), async_functions_(other.async_functions_), bindings_(other.bindings_),
+		  shared_values_(other.shared_values_),
+		  unknown_function_resolver_(other.unknown_function_resolver_), keep_unknown_functions_(other.keep_unknown_functions_),
+		  unknown_var_resolver_(other.unknown_var_resolver_), keep_unknown_vars_(other.keep_unknown_vars_),
+		  async_var_resolver_(other.async_var_resolver_)
+	{
+		// the compiled program is shared, the slots have to point to the variables of the copy
+		context_.set_unknown_var_resolver(unknown_var_resolver_);
+		context_.set_async_var_resolver(async_var_resolver_);
+		bind_slots();
+	}
+
 	void print_tokens(const token_stream_t &tokens) const;
-	token_stream_t get_tokens() const { return output_compiled_; }
+	// postfix tokens of the compiled expression
+	token_stream_t get_tokens() const;
 
 	void compile();
 	void compile(const string_t &exp)
@@ -173,6 +388,14 @@ public:
 		expression_ = exp;
 		compile();
 	}
+	// same as compile(), the error is returned with its code and the offset in the expression
+	// where it was found (when the parser knows it) instead of printed
+	expr_result<compiled_expr_ptr> try_compile() noexcept;
+	expr_result<compiled_expr_ptr> try_compile(const string_t &exp) noexcept
+	{
+		expression_ = exp;
+		return try_compile();
+	}
 	void set_unknown_function_resolver(function_resolver_t resolver, bool keep)
 	{
 		this->unknown_function_resolver_ = resolver;
@@ -182,6 +405,13 @@ public:
 	{
 		this->unknown_var_resolver_ = resolver;
 		this->keep_unknown_vars_ = keep;
+		this->context_.set_unknown_var_resolver(resolver);
+	}
+	// resolver of eval_async(), unknown variables are awaited from it instead of calling the one above
+	void set_async_var_resolver(async_resolver_t resolver)
+	{
+		this->async_var_resolver_ = resolver;
+		this->context_.set_async_var_resolver(std::move(resolver));
 	}
 
 	expr &operator=(const expr &other)
@@ -189,8 +419,23 @@ public:
 		if (this == &other)
 			return *this;
 		expression_ = other.expression_;
+		compiled_ = other.compiled_;
+		context_ = eval_context(other.compiled_);
+		jit_enabled_ = other.jit_enabled_;
 		variables_ = other.variables_;
 		functions_ = other.functions_;
+		async_functions_ = other.async_functions_;
+		bindings_ = other.bindings_;
+		shared_values_ = other.shared_values_;
+		unknown_function_resolver_ = other.unknown_function_resolver_;
+		keep_unknown_functions_ = other.keep_unknown_functions_;
+		unknown_var_resolver_ = other.unknown_var_resolver_;
+		keep_unknown_vars_ = other.keep_unknown_vars_;
+		async_var_resolver_ = other.async_var_resolver_;
+		// the program was compiled for the bindings of other
+		context_.set_unknown_var_resolver(unknown_var_resolver_);
+		context_.set_async_var_resolver(async_var_resolver_);
+		bind_slots();
 		return *this;
 	}
 
@@ -202,15 +447,33 @@ public:
 		}
 		for (const auto &f : variables)
 		{
-			auto v_name = f.first;
-			auto v_data = f.second;
-
 			// there is some types that are not exactly num_t(double) so they are converted to nlohmann::json_abi_v3_11_2::detail::value_t::number_integer
 			// so we need to convert them to num_t
+			auto &v_data = variables_[f.first];
+			v_data = f.second;
 			json_to_correct_dtype(v_data);
-			variables_[v_name] = v_data;
 		}
+		// new variables may fill slots that were unbound
+		bind_slots();
+	}
+
+	// bind a variable to storage owned by the caller, eval reads the value through the pointer
+	// so it can change between evaluations without calling this again. Bindings take precedence
+	// over set_variables and can be made before or after compile()
+	void bind(const string_t &name, const num_t *value) { bind(name, binding_kind::NUMBER, value); }
+	void bind(const string_t &name, const string_t *value) { bind(name, binding_kind::STRING, value); }
+	void bind(const string_t &name, const json_t *value) { bind(name, binding_kind::JSON, value); }
+	void bind(const string_t &name, const token_data_t *value) { bind(name, binding_kind::VALUE, value); }
+	// bind a document shared with other expressions and threads, for example a large request that
+	// every rule reads. It is never copied and stays alive as long as it is bound to a copy of this expr
+	void bind(const string_t &name, shared_json_t value)
+	{
+		const json_t *ptr = value.get();
+		if (value)
+			shared_values_[name] = std::move(value);
+		bind(name, binding_kind::JSON, ptr);
 	}
+	void unbind(const string_t &name) { bind(name, binding_kind::NONE, nullptr); }
 
 	void set_functions(const std::unordered_map<string_t, f_function_info> &functions)
 	{
@@ -220,13 +483,34 @@ public:
 		}
 	}
 
+	// functions that return an eval_task, calls to them can only be evaluated by eval_async()
+	void set_async_functions(const std::unordered_map<string_t, a_function_info> &functions)
+	{
+		for (const auto &f : functions)
+		{
+			async_functions_[f.first] = f.second;
+		}
+	}
+
+	// translate numeric programs into native code (x86-64 only), also enabled by defining EXPR_JIT
+	// returns true if the current program runs as native code, otherwise the interpreter is used
+	bool jit(bool enabled = true);
+	bool is_native() const noexcept { return compiled_->is_native(); }
+
+	const program_t &get_program() const noexcept { return compiled_->program(); }
+
+	// the compiled program, to be shared between threads that evaluate it with their own eval_context
+	compiled_expr_ptr compiled() const noexcept { return compiled_; }
+
 	parser_dtype eval();
+	expr_result<parser_dtype> try_eval() noexcept;
+	eval_task<parser_dtype> eval_async() { return context_.eval_async(); }
 
 	static parser_dtype eval(const string_t &expression);
 };
 
 inline const std::unordered_set<string_t> expr::operators_ = {
-	"==", "!=", "<=", ">=", "&&", "||", "!", "<", ">", "+", "-", "*", "/", "%", "^", ".", "[]"};
+	"==", "!=", "<=", ">=", "&&", "||", "!", "<", ">", "+", "-", "*", "/", "%", "^", ".", "[]", "?", ":"};
 
 inline const std::unordered_set<string_t> expr::literals_ = {"true", "false", "null"};
 
@@ -245,7 +529,28 @@ inline const std::unordered_map<string_t, operator_info_t> expr::operator_info_m
 	{">=", {1, false, 2}},
 	{"&&", {0, false, 2}},
 	{"||", {0, false, 2}},
+	{"?", {-1, true, 2}}, // c ? a : b se agrupa como c ? (a : b)
+	{":", {-1, true, 2}},
 	{"!", {5, true, 1}}, // Operadores unarios tienen mayor precedencia
 	{".", {7, false, 2}},
 	{"[", {7, false, 2}},
 	{"[]", {7, false, 2}}};
+
+inline const std::unordered_map<string_t, opcode> expr::operator_opcodes_ = {
+	{"+", opcode::ADD},
+	{"-", opcode::SUB},
+	{"*", opcode::MUL},
+	{"/", opcode::DIV},
+	{"%", opcode::MOD},
+	{"^", opcode::POW},
+	{"==", opcode::EQ},
+	{"!=", opcode::NEQ},
+	{"<", opcode::LT},
+	{"<=", opcode::LTE},
+	{">", opcode::GT},
+	{">=", opcode::GTE},
+	{"&&", opcode::AND},
+	{"||", opcode::OR},
+	{"!", opcode::NOT},
+	{".", opcode::ACCESS},
+	{"[]", opcode::INDEX}};
@@ -0,0 +1,455 @@
+#include "my_expr_aot.h"
+#include "my_expr.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(EXPR_NO_AOT)
+#define EXPR_AOT_DLOPEN
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#pragma region codegen
+
+// numeric builtins written inline in the generated code, %0, %1... are the arguments
+static const std::unordered_map<m_generic_function, const char *> inline_builtins = {
+    {m_parser_builtins::cos_f, "std::cos(%0)"},
+    {m_parser_builtins::sin_f, "std::sin(%0)"},
+    {m_parser_builtins::pow_f, "std::pow(%0, %1)"},
+    {m_parser_builtins::tan_f, "std::tan(%0)"},
+    {m_parser_builtins::cot_f, "1 / std::tan(%0)"},
+    {m_parser_builtins::abs_f, "std::abs(%0)"},
+    {m_parser_builtins::log_f, "std::log(%0)"},
+    {m_parser_builtins::log10_f, "std::log10(%0)"},
+    {m_parser_builtins::exp_f, "std::exp(%0)"},
+    {m_parser_builtins::sqrt_f, "std::sqrt(%0)"},
+    {m_parser_builtins::sinh_f, "std::sinh(%0)"},
+    {m_parser_builtins::cosh_f, "std::cosh(%0)"},
+    {m_parser_builtins::tanh_f, "std::tanh(%0)"},
+    {m_parser_builtins::asin_f, "std::asin(%0)"},
+    {m_parser_builtins::acos_f, "std::acos(%0)"},
+    {m_parser_builtins::atan_f, "std::atan(%0)"},
+    {m_parser_builtins::atan2_f, "std::atan2(%0, %1)"},
+    {m_parser_builtins::ceil_f, "std::ceil(%0)"},
+    {m_parser_builtins::floor_f, "std::floor(%0)"},
+    {m_parser_builtins::clamp_f, "std::clamp(%0, %1, %2)"},
+    {m_parser_builtins::fac_f, "std::tgamma(%0 + 1)"},
+    {m_parser_builtins::max_f, "std::max(%0, %1)"},
+    {m_parser_builtins::min_f, "std::min(%0, %1)"},
+    {m_parser_builtins::round_f, "std::round(%0)"},
+    {m_parser_builtins::trunc_f, "std::trunc(%0)"},
+    {m_parser_builtins::rem_f, "std::remainder(%0, %1)"},
+    {m_parser_builtins::hypot_f, "std::hypot(%0, %1)"}};
+
+static const char *num_type_name()
+{
+    if (std::is_same<num_t, float>::value)
+        return "float";
+    if (std::is_same<num_t, long double>::value)
+        return "long double";
+    return "double";
+}
+
+// exact spelling of a constant
+static string_t num_literal(num_t value)
+{
+    if (std::isnan(value))
+        return "std::numeric_limits<num_t>::quiet_NaN()";
+    if (std::isinf(value))
+        return value > 0 ? "std::numeric_limits<num_t>::infinity()" : "-std::numeric_limits<num_t>::infinity()";
+    std::ostringstream out;
+    out << "num_t(" << std::hexfloat << static_cast<long double>(value) << "L)";
+    return out.str();
+}
+
+// functions that are not inlined are called through <symbol>_fns, filled by the loader
+static std::vector<m_generic_function> called_functions(const program_t &program)
+{
+    std::vector<m_generic_function> functions;
+    for (const auto &function : program.m_functions)
+        if (!inline_builtins.count(function.func))
+            functions.push_back(function.func);
+    return functions;
+}
+
+string_t aot_compiler::generate_function(const program_t &program, const string_t &symbol)
+{
+    const uint32_t nconst = static_cast<uint32_t>(program.num_constants.size());
+    std::ostringstream out;
+
+    // registers: constants are literals, the rest are locals the compiler can keep in registers
+    auto reg = [&](uint32_t r)
+    {
+        return r < nconst ? num_literal(program.num_constants[r]) : "t[" + std::to_string(r - nconst) + "]";
+    };
+
+    out << "extern \"C\" num_t (*" << symbol << "_fns[" << std::max<size_t>(called_functions(program).size(), 1) << "])(const num_t *);\n";
+    out << "num_t (*" << symbol << "_fns[" << std::max<size_t>(called_functions(program).size(), 1) << "])(const num_t *) = {};\n";
+    out << "extern \"C\" num_t " << symbol << "(num_t *, const slot *s)\n{\n";
+    out << "    num_t t[" << std::max<uint32_t>(program.num_registers - nconst, 1) << "];\n";
+
+    size_t next_called = 0;
+    std::unordered_map<m_generic_function, size_t> called_index;
+    const auto &code = program.code;
+    for (size_t pc = 0; pc < code.size(); pc++)
+    {
+        const auto &ins = code[pc];
+        const string_t dst = reg(ins.dst), a = reg(ins.a), b = reg(ins.b);
+        out << "L" << pc << ": ";
+        switch (ins.op)
+        {
+        case opcode::LOAD_VAR:
+            out << dst << " = *static_cast<const num_t *>(s[" << ins.a << "].ptr);";
+            break;
+        case opcode::LOAD_VAR2:
+        case opcode::LOAD_VAR3:
+            out << dst << " = *static_cast<const num_t *>(s[" << ins.a << "].ptr); ";
+            out << reg(ins.dst + 1) << " = *static_cast<const num_t *>(s[" << ins.b << "].ptr);";
+            if (ins.op == opcode::LOAD_VAR3)
+                out << " " << reg(ins.dst + 2) << " = *static_cast<const num_t *>(s[" << ins.c << "].ptr);";
+            break;
+        case opcode::MOVE:
+            out << dst << " = " << a << ";";
+            break;
+        case opcode::CALL_M:
+        {
+            const auto func = program.m_functions[ins.c].func;
+            auto builtin = inline_builtins.find(func);
+            if (builtin != inline_builtins.end())
+            {
+                string_t call = builtin->second;
+                for (uint32_t i = 0; i < ins.b; i++)
+                {
+                    const string_t placeholder = "%" + std::to_string(i), arg = "num_t(" + reg(ins.a + i) + ")";
+                    for (size_t at = call.find(placeholder); at != string_t::npos; at = call.find(placeholder, at + arg.size()))
+                        call.replace(at, placeholder.size(), arg);
+                }
+                out << dst << " = " << call << ";";
+            }
+            else
+            {
+                // the arguments have to be consecutive in memory
+                if (!called_index.count(func))
+                    called_index[func] = next_called++;
+                out << "{ num_t args[" << std::max<uint32_t>(ins.b, 1) << "] = {";
+                for (uint32_t i = 0; i < ins.b; i++)
+                    out << (i ? ", " : "") << reg(ins.a + i);
+                out << "}; " << dst << " = " << symbol << "_fns[" << called_index[func] << "](args); }";
+            }
+            break;
+        }
+
+        case opcode::JUMP:
+            out << "goto L" << ins.c << ";";
+            break;
+        case opcode::JUMP_IF_FALSE:
+            out << "if (" << a << " == 0) goto L" << ins.c << ";";
+            break;
+        case opcode::AND_JUMP:
+            out << "if (" << a << " == 0) { " << dst << " = 0; goto L" << ins.c << "; }";
+            break;
+        case opcode::OR_JUMP:
+            out << "if (" << a << " != 0) { " << dst << " = " << a << "; goto L" << ins.c << "; }";
+            break;
+
+        case opcode::ADD:
+            out << dst << " = " << a << " + " << b << ";";
+            break;
+        case opcode::SUB:
+            out << dst << " = " << a << " - " << b << ";";
+            break;
+        case opcode::MUL:
+            out << dst << " = " << a << " * " << b << ";";
+            break;
+        case opcode::DIV:
+            out << dst << " = " << a << " / " << b << ";";
+            break;
+        case opcode::MOD:
+            out << dst << " = std::fmod(" << a << ", " << b << ");";
+            break;
+        case opcode::POW:
+            out << dst << " = std::pow(" << a << ", " << b << ");";
+            break;
+        case opcode::EQ:
+            out << dst << " = " << a << " == " << b << ";";
+            break;
+        case opcode::NEQ:
+            out << dst << " = " << a << " != " << b << ";";
+            break;
+        case opcode::LT:
+            out << dst << " = " << a << " < " << b << ";";
+            break;
+        case opcode::LTE:
+            out << dst << " = " << a << " <= " << b << ";";
+            break;
+        case opcode::GT:
+            out << dst << " = " << a << " > " << b << ";";
+            break;
+        case opcode::GTE:
+            out << dst << " = " << a << " >= " << b << ";";
+            break;
+        case opcode::NOT:
+            out << dst << " = " << a << " == 0;";
+            break;
+
+        case opcode::MUL_ADD:
+            // rounded twice like the interpreter, the module is built with -ffp-contract=off
+            out << "{ num_t product = " << a << " * " << b << "; " << dst << " = product + " << reg(ins.c) << "; }";
+            break;
+        case opcode::BINARY_VAR:
+        {
+            const string_t var = "*static_cast<const num_t *>(s[" + std::to_string(ins.a) + "].ptr)";
+            static const char *const operators[] = {" + ", " - ", " * ", " / ", "", "", " == ", " != ", " < ", " <= ", " > ", " >= "};
+            const auto op = static_cast<opcode>(ins.c);
+            if (op == opcode::MOD || op == opcode::POW)
+                out << dst << " = std::" << (op == opcode::MOD ? "fmod(" : "pow(") << var << ", " << b << ");";
+            else
+                out << dst << " = " << var << operators[ins.c - static_cast<uint32_t>(opcode::ADD)] << b << ";";
+            break;
+        }
+
+        case opcode::RETURN:
+            out << "return " << a << ";";
+            break;
+
+        default:
+            throw std::runtime_error("Invalid instruction in numeric program");
+        }
+        out << "\n";
+    }
+
+    out << "}\n";
+    return out.str();
+}
+
+static string_t module_prelude()
+{
+    std::ostringstream out;
+    out << "// generated by my_expr, do not edit\n"
+        << "#include <algorithm>\n#include <cmath>\n#include <limits>\n"
+        << "typedef " << num_type_name() << " num_t;\n"
+        << "struct slot { unsigned char kind; const void *ptr; };\n"
+        << "static_assert(sizeof(slot) == " << sizeof(slot_binding_t) << ", \"slot layout\");\n"
+        << "#pragma GCC diagnostic ignored \"-Wunused-label\"\n";
+    return out.str();
+}
+
+// 64 bit FNV-1a, as hex
+static string_t hash_text(const string_t &text)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (unsigned char c : text)
+    {
+        hash ^= c;
+        hash *= 0x100000001b3ull;
+    }
+    std::ostringstream out;
+    out << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return out.str();
+}
+
+#pragma endregion
+
+#pragma region loader
+
+aot_compiler::aot_compiler(string_t cache_dir, string_t cxx) : cache_dir_(std::move(cache_dir)), cxx_(std::move(cxx))
+{
+    if (cache_dir_.empty())
+    {
+        // a directory of the user, never a shared one: anything found there is loaded into the process
+        const char *xdg = std::getenv("XDG_CACHE_HOME");
+        const char *home = std::getenv("HOME");
+        if (xdg && *xdg == '/')
+            cache_dir_ = (std::filesystem::path(xdg) / "my_expr_aot").string();
+        else if (home && *home == '/')
+            cache_dir_ = (std::filesystem::path(home) / ".cache" / "my_expr_aot").string();
+    }
+    if (cxx_.empty())
+    {
+        const char *env = std::getenv("EXPR_AOT_CXX");
+        cxx_ = env && *env ? env : "c++";
+    }
+}
+
+#ifdef EXPR_AOT_DLOPEN
+// guards the function tables of every loaded module. dlopen gives the same module to all the
+// compilers that load the same file, so a lock of the instance is not enough
+static std::mutex tables_mutex;
+#endif
+
+size_t aot_compiler::build(const std::vector<expr *> &rules)
+{
+    // one function per distinct program, rules with the same code share it
+    std::vector<string_t> symbols(rules.size());
+    std::unordered_map<string_t, string_t> functions; // symbol -> source
+    for (size_t i = 0; i < rules.size(); i++)
+    {
+        if (!rules[i] || !rules[i]->get_program().numeric)
+            continue;
+        string_t body = generate_function(rules[i]->get_program(), "@");
+        symbols[i] = "expr_" + hash_text(body);
+        functions.emplace(symbols[i], generate_function(rules[i]->get_program(), symbols[i]));
+    }
+    if (functions.empty())
+        return 0;
+
+    // the module is keyed by the hash of its whole source
+    std::vector<string_t> ordered;
+    for (const auto &function : functions)
+        ordered.push_back(function.first);
+    std::sort(ordered.begin(), ordered.end());
+    string_t source = module_prelude();
+    for (const auto &symbol : ordered)
+        source += functions[symbol];
+
+    std::shared_ptr<void> module;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        module = this->load_module(hash_text(source + cxx_), source);
+    }
+    if (!module)
+        return 0;
+
+    size_t built = 0;
+#ifdef EXPR_AOT_DLOPEN
+    for (size_t i = 0; i < rules.size(); i++)
+    {
+        if (symbols[i].empty())
+            continue;
+        auto entry = reinterpret_cast<native_entry_t>(dlsym(module.get(), symbols[i].c_str()));
+        auto table = reinterpret_cast<m_generic_function *>(dlsym(module.get(), (symbols[i] + "_fns").c_str()));
+        if (!entry || !table)
+            continue;
+
+        // the table is shared by the rules with the same code, their callees have to match
+        auto called = called_functions(rules[i]->get_program());
+        std::vector<m_generic_function> distinct;
+        for (auto function : called)
+            if (std::find(distinct.begin(), distinct.end(), function) == distinct.end())
+                distinct.push_back(function);
+        {
+            // checked and filled in one step, two builds could otherwise fill an entry each with their callee
+            std::lock_guard<std::mutex> lock(tables_mutex);
+            bool compatible = true;
+            for (size_t f = 0; f < distinct.size(); f++)
+            {
+                if (table[f] && table[f] != distinct[f])
+                    compatible = false;
+            }
+            if (!compatible)
+                continue;
+            for (size_t f = 0; f < distinct.size(); f++)
+                table[f] = distinct[f];
+        }
+
+        rules[i]->set_native_code(entry, module);
+        built++;
+    }
+#endif
+    return built;
+}
+
+#ifdef EXPR_AOT_DLOPEN
+// a directory or a file (not a link to one) of the effective user that no one else can write to
+static bool is_private(const string_t &path, bool directory)
+{
+    struct stat info;
+    if (lstat(path.c_str(), &info) != 0)
+        return false;
+    const bool type = directory ? S_ISDIR(info.st_mode) : S_ISREG(info.st_mode);
+    return type && info.st_uid == geteuid() && (info.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+// the cache directory, created with mode 0700. Returns false when it can not be trusted
+static bool prepare_cache_dir(const string_t &cache_dir)
+{
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    const fs::path dir(cache_dir);
+    if (dir.has_parent_path())
+        fs::create_directories(dir.parent_path(), ec);
+    if (mkdir(cache_dir.c_str(), S_IRWXU) != 0 && errno != EEXIST)
+        return false;
+    return is_private(cache_dir, true);
+}
+
+// new file of the cache directory with a unique name ending in suffix, open for writing
+static int create_temp_file(const string_t &cache_dir, const string_t &prefix, const string_t &suffix, string_t &path)
+{
+    string_t name = (std::filesystem::path(cache_dir) / (prefix + ".XXXXXX" + suffix)).string();
+    const int fd = mkstemps(name.data(), static_cast<int>(suffix.size()));
+    if (fd >= 0)
+        path = std::move(name);
+    return fd;
+}
+#endif
+
+std::shared_ptr<void> aot_compiler::load_module(const string_t &hash, const string_t &source)
+{
+#ifdef EXPR_AOT_DLOPEN
+    auto loaded = this->modules_.find(hash);
+    if (loaded != this->modules_.end())
+        return loaded->second;
+
+    // the libraries are only loaded from a directory of this user that no one else can write to
+    namespace fs = std::filesystem;
+    if (cache_dir_.empty() || !prepare_cache_dir(cache_dir_))
+        return nullptr;
+    const string_t library = (fs::path(cache_dir_) / ("expr_" + hash + ".so")).string();
+
+    std::error_code ec;
+    if (!fs::exists(library, ec))
+    {
+        // the source and the library get unique names, the library is renamed into place once it is
+        // complete, so another process never loads half a file
+        string_t source_file, tmp_library;
+        int fd = create_temp_file(cache_dir_, "expr_" + hash, ".cpp", source_file);
+        if (fd < 0)
+            return nullptr;
+        const bool written = ::write(fd, source.data(), source.size()) == static_cast<ssize_t>(source.size());
+        ::close(fd);
+        fd = written ? create_temp_file(cache_dir_, "expr_" + hash, ".so.tmp", tmp_library) : -1;
+        if (fd < 0)
+        {
+            fs::remove(source_file, ec);
+            return nullptr;
+        }
+        ::close(fd);
+
+        const string_t command = cxx_ + " -O2 -std=c++17 -ffp-contract=off -shared -fPIC -o \"" + tmp_library + "\" \"" + source_file + "\" 2>/dev/null";
+        const bool built = std::system(command.c_str()) == 0 && chmod(tmp_library.c_str(), S_IRWXU) == 0;
+        fs::remove(source_file, ec);
+        if (built)
+            fs::rename(tmp_library, library, ec);
+        if (!built || ec)
+        {
+            fs::remove(tmp_library, ec);
+            return nullptr;
+        }
+    }
+
+    if (!is_private(library, false))
+        return nullptr;
+    void *handle = dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!handle)
+        return nullptr;
+    std::shared_ptr<void> module(handle, [](void *h)
+                                 { dlclose(h); });
+    this->modules_.emplace(hash, module);
+    return module;
+#else
+    (void)hash;
+    (void)source;
+    return nullptr;
+#endif
+}
+
+#pragma endregion
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "my_expr_bytecode.h"
+
+class expr;
+
+// Ahead-of-time backend for numeric programs: the programs are turned into C++ source, one
+// function per expression, built with the system compiler into a shared object and loaded
+// back with dlopen. Shared objects are cached on disk by the hash of their source, so a rule
+// set that does not change is only built once, even across processes. Whatever is in the cache
+// is loaded into the process, so the directory and the libraries must belong to the effective
+// user and not be writable by anyone else, or nothing is built or loaded.
+// Expressions that are not numeric, or platforms without dlopen, keep using the interpreter.
+class aot_compiler
+{
+public:
+    // cache_dir defaults to $XDG_CACHE_HOME/my_expr_aot or ~/.cache/my_expr_aot, created with mode
+    // 0700; without either variable it has to be given. cxx defaults to $EXPR_AOT_CXX or "c++"
+    explicit aot_compiler(string_t cache_dir = "", string_t cxx = "");
+
+    // build every numeric expression of the rule set into a single shared object and make
+    // them evaluate through it, returns the number of expressions that run as native code
+    size_t build(const std::vector<expr *> &rules);
+    bool build(expr &rule) { return build(std::vector<expr *>{&rule}) == 1; }
+
+    // C++ source of the function computing a numeric program
+    static string_t generate_function(const program_t &program, const string_t &symbol);
+
+    const string_t &cache_dir() const noexcept { return cache_dir_; }
+
+private:
+    string_t cache_dir_;
+    string_t cxx_;
+    std::mutex mutex_;
+    std::unordered_map<string_t, std::shared_ptr<void>> modules_; // loaded shared objects by hash
+
+    std::shared_ptr<void> load_module(const string_t &hash, const string_t &source);
+};
@@ -0,0 +1,63 @@
+#include "my_expr.h"
+
+// The interpreter runs until it reaches a variable the async resolver has to give or a call to an
+// asynchronous function, returns, and is started again at that instruction once the value was
+// awaited. Everything else runs exactly like eval()
+eval_task<parser_dtype> eval_context::eval_async()
+{
+    if (!this->compiled_ || this->compiled_->program_.empty())
+        throw std::runtime_error("Expression is not compiled");
+    if (!this->slots_checked_)
+        this->check_slots();
+
+    if (this->compiled_->native_entry_)
+        co_return parser_dtype{this->compiled_->native_entry_(this->num_registers_.data(), this->slots_.data())};
+    if (this->numeric_slots_)
+        co_return parser_dtype{this->run_numeric()};
+
+    // slots bound to a resolved value for this evaluation only, unbound again even if it fails
+    // or the task is destroyed while suspended
+    struct awaiting_scope
+    {
+        eval_context &context;
+        std::vector<uint32_t> resolved;
+
+        explicit awaiting_scope(eval_context &c) : context(c) { context.awaiting_ = true; }
+        ~awaiting_scope()
+        {
+            for (uint32_t slot : resolved)
+            {
+                context.slots_[slot] = slot_binding_t();
+                context.values_[slot] = token_data_t();
+            }
+            context.awaiting_ = false;
+        }
+    } scope(*this);
+
+    const auto &program = this->compiled_->program_;
+    uint32_t pc = 0;
+    while (true)
+    {
+        if (const token_data_t *result = this->run(pc))
+            co_return parser_dtype{*result};
+
+        pc = this->await_pc_;
+        const auto &ins = program.code[pc];
+        if (ins.op == opcode::CALL_A)
+        {
+            token_data_t value = co_await program.a_functions[ins.c].func(this->registers_.data() + ins.a);
+            this->registers_[ins.dst] = std::move(value);
+            pc++;
+        }
+        else
+        {
+            // the instruction that loads the variable runs again, now with the value bound
+            const uint32_t slot = this->await_slot_;
+            token_data_t value = co_await this->async_var_resolver_(program.names[slot]);
+            json_to_correct_dtype(value);
+            this->values_[slot] = std::move(value);
+            this->slots_[slot] = {binding_kind::VALUE, &this->values_[slot]};
+            scope.resolved.push_back(slot);
+        }
+    }
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <utility>
+
+#include "my_expr_dtypes.h"
+
+// Lazy coroutine returning a T. The body starts when the task is awaited (or start() is called)
+// and resumes the coroutine awaiting it when it finishes, through symmetric transfer so long
+// chains of tasks do not grow the stack. Exceptions are rethrown to the awaiting coroutine
+template <typename T>
+class eval_task
+{
+public:
+    struct promise_type
+    {
+        std::optional<T> value;
+        std::exception_ptr error;
+        std::coroutine_handle<> continuation;
+
+        eval_task get_return_object() noexcept { return eval_task(handle_t::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        struct final_awaiter
+        {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+            {
+                auto continuation = handle.promise().continuation;
+                return continuation ? continuation : std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+        final_awaiter final_suspend() noexcept { return {}; }
+
+        template <typename U>
+        void return_value(U &&result) { value.emplace(std::forward<U>(result)); }
+        void unhandled_exception() noexcept { error = std::current_exception(); }
+    };
+
+    eval_task(eval_task &&other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+    eval_task &operator=(eval_task &&other) noexcept
+    {
+        if (this != &other)
+        {
+            if (handle_)
+                handle_.destroy();
+            handle_ = std::exchange(other.handle_, {});
+        }
+        return *this;
+    }
+    eval_task(const eval_task &) = delete;
+    eval_task &operator=(const eval_task &) = delete;
+    ~eval_task()
+    {
+        if (handle_)
+            handle_.destroy();
+    }
+
+    bool await_ready() const noexcept { return handle_.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        handle_.promise().continuation = awaiting;
+        return handle_;
+    }
+    T await_resume() { return get(); }
+
+    // for the caller that is not a coroutine: start() runs the task until it first suspends,
+    // whatever resumes it later (an event loop, a callback) runs it further until done()
+    void start() { handle_.resume(); }
+    bool done() const noexcept { return handle_.done(); }
+
+    // result of a finished task, rethrows its exception
+    T get()
+    {
+        auto &promise = handle_.promise();
+        if (promise.error)
+            std::rethrow_exception(promise.error);
+        return std::move(*promise.value);
+    }
+
+private:
+    using handle_t = std::coroutine_handle<promise_type>;
+    handle_t handle_;
+
+    explicit eval_task(handle_t handle) noexcept : handle_(handle) {}
+};
+
+// Value produced by a callback based API. Copies share the same state: one is awaited, another one
+// is given to the producer, which calls set_value() or set_error() once, from any thread. The
+// awaiting coroutine resumes on the thread that sets the value, or does not suspend if it is set
+template <typename T>
+class async_result
+{
+public:
+    async_result() : state_(std::make_shared<state_t>()) {}
+
+    void set_value(T value)
+    {
+        state_->value.emplace(std::move(value));
+        complete();
+    }
+    void set_error(std::exception_ptr error)
+    {
+        state_->error = std::move(error);
+        complete();
+    }
+
+    bool await_ready() const noexcept { return state_->ready.load(std::memory_order_acquire); }
+    bool await_suspend(std::coroutine_handle<> awaiting)
+    {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        if (state_->ready.load(std::memory_order_relaxed))
+            return false;
+        state_->awaiting = awaiting;
+        return true;
+    }
+    T await_resume()
+    {
+        if (state_->error)
+            std::rethrow_exception(state_->error);
+        return std::move(*state_->value);
+    }
+
+private:
+    struct state_t
+    {
+        std::mutex mutex;
+        std::atomic<bool> ready{false};
+        std::optional<T> value;
+        std::exception_ptr error;
+        std::coroutine_handle<> awaiting;
+    };
+    std::shared_ptr<state_t> state_;
+
+    void complete()
+    {
+        std::coroutine_handle<> awaiting;
+        {
+            std::lock_guard<std::mutex> lock(state_->mutex);
+            state_->ready.store(true, std::memory_order_release);
+            awaiting = std::exchange(state_->awaiting, {});
+        }
+        if (awaiting)
+            awaiting.resume();
+    }
+};
+
+// resolver of unknown variables for eval_async(), the evaluation is suspended until the value arrives
+using async_resolver_t = std::function<eval_task<token_data_t>(std::string_view symbol)>;
+
+// user function for eval_async(), args stay valid until the returned task finishes
+using a_generic_function = std::function<eval_task<token_data_t>(const token_data_t *args)>;
+
+struct a_function_info
+{
+    a_generic_function func;
+    int num_args;
+};
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "my_expr_dtypes.h"
+#include "my_expr_async.h"
+
+// expression tree rebuilt from the postfix stream, used to lower it into bytecode
+struct ast_node_t
+{
+    token_types type; // LITERAL, VARIABLE, OPERATOR or FUNCTION
+    token_data_t value; // literal value, variable, operator or function name
+    std::vector<std::unique_ptr<ast_node_t>> args;
+    uint32_t reg = 0; // constant register, only for literals
+
+    ast_node_t(token_types t, token_data_t v) : type(t), value(std::move(v)) {}
+};
+
+using ast_ptr_t = std::unique_ptr<ast_node_t>;
+
+enum class opcode : uint8_t
+{
+    LOAD_VAR,  // r[dst] = value bound to variable slot a
+    LOAD_VAR2, // r[dst] = slot a, r[dst + 1] = slot b
+    LOAD_VAR3, // r[dst] = slot a, r[dst + 1] = slot b, r[dst + 2] = slot c
+    LOAD_REF,  // ref[dst] = json bound to slot a, not copied. Any other value is loaded into r[dst] with ref[dst] = nullptr
+    MOVE,     // r[dst] = r[a]
+    CALL_M,   // r[dst] = m_functions[c](r[a], ..., r[a + b - 1]) with the arguments converted to numbers
+    CALL_F,   // r[dst] = f_functions[c](r[a], ..., r[a + b - 1])
+    CALL_A,   // r[dst] = co_await a_functions[c](r[a], ..., r[a + b - 1]), only in eval_async()
+
+    // control flow, c is the target instruction
+    JUMP,          // goto c
+    JUMP_IF_FALSE, // if !r[a] goto c
+    AND_JUMP,      // if !r[a] { r[dst] = falsy value of r[a]; goto c }
+    OR_JUMP,       // if r[a] { r[dst] = r[a]; goto c }
+
+    // operators, r[dst] = r[a] op r[b]
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+    MOD,
+    POW,
+    EQ,
+    NEQ,
+    LT,
+    LTE,
+    GT,
+    GTE,
+    AND,
+    OR,
+    NOT, // r[dst] = !r[a]
+    ACCESS, // r[dst] = r[a].r[b], or ref[a].r[b] when c is 1 and ref[a] is set
+    INDEX,  // r[dst] = r[a][r[b]], or ref[a][r[b]] when c is 1 and ref[a] is set
+
+    // steps of a json path that is not finished, the operand is read like ACCESS and INDEX do and the
+    // result is a reference into it in ref[dst]. When the operand is not a json, r[dst] gets the value
+    // of ACCESS or INDEX and ref[dst] = nullptr
+    ACCESS_REF,
+    INDEX_REF,
+    // . and [] with the constant keys of path b (see program_t::path_keys) in one instruction. The operand
+    // is r[a], or ref[a] when bit 0 of c is set; with bit 1 the result is a reference in ref[dst]
+    PATH,
+
+    // superinstructions
+    MUL_ADD,     // r[dst] = r[a] * r[b] + r[c], rounded after each operation like MUL and ADD
+    BINARY_VAR,  // r[dst] = slot a <c> r[b], c is one of ADD ... GTE
+    ACCESS_VAR,  // r[dst] = slot a <c> r[b], c is ACCESS, INDEX, ACCESS_REF or INDEX_REF, the bound value is not copied
+    PATH_VAR,    // PATH over the value bound to slot a, the result is a reference when c is 1
+
+    RETURN // return r[a], always the last instruction
+};
+
+constexpr size_t num_opcodes = static_cast<size_t>(opcode::RETURN) + 1;
+
+// function called by a call site, exactly one of them is set
+struct callee_t
+{
+    const m_function_info *m = nullptr;
+    const f_function_info *f = nullptr;
+    const a_function_info *a = nullptr;
+
+    int num_args() const noexcept { return m ? m->num_args : f ? f->num_args : a->num_args; }
+};
+
+// max number of arguments of a numeric builtin, they are converted on the stack
+constexpr uint32_t max_m_function_args = 8;
+
+// registers, slots, jump targets and callees are 16 bit indexes, an instruction takes 10 bytes.
+// Programs that do not fit are rejected by compile()
+using operand_t = uint16_t;
+constexpr uint32_t max_operand = UINT16_MAX;
+
+struct instruction_t
+{
+    opcode op;
+    operand_t dst;
+    operand_t a;
+    operand_t b;
+    operand_t c;
+
+    instruction_t() = default;
+    instruction_t(opcode op, uint32_t dst, uint32_t a, uint32_t b, uint32_t c)
+        : op(op), dst(static_cast<operand_t>(dst)), a(static_cast<operand_t>(a)), b(static_cast<operand_t>(b)), c(static_cast<operand_t>(c)) {}
+};
+
+enum class binding_kind : uint8_t
+{
+    NONE,   // resolved by the unknown variable resolver
+    VALUE,  // const token_data_t *
+    NUMBER, // const num_t *
+    STRING, // const string_t *
+    JSON    // const json_t *
+};
+
+// value a program reads from a variable: the variable in slot, or its element at the end of keys.
+// String keys are . and number keys are []; anything below the element may be read too
+struct json_path_t
+{
+    uint32_t slot = 0;
+    std::vector<token_data_t> keys;
+    bool dynamic = false; // the element is also read with a key computed at run time
+};
+
+// Register based program:
+//  - registers [0, constants.size()) hold the distinct literals, they are loaded once at compile time
+//  - the rest are temporaries, a value that is at depth d of the operand stack lives in r[constants.size() + d]
+struct program_t
+{
+    std::vector<instruction_t> code;
+    std::vector<token_data_t> constants;
+    std::vector<string_t> names; // variable names, the position of a name is its slot
+    std::vector<binding_kind> slot_types; // NUMBER if the code was optimized for a number in the slot
+    std::vector<m_function_info> m_functions; // callees bound at compile time
+    std::vector<m_column_function> m_kernels; // column versions of m_functions for batches, nullptr if there is none
+    std::vector<f_function_info> f_functions;
+    std::vector<a_function_info> a_functions;
+    // keys of the PATH instructions, each path is its number of keys followed by their constant registers.
+    // String keys are . and number keys are []
+    std::vector<uint32_t> path_keys;
+    // the constant part of every . and [] chain over a variable, and the variables read as a whole
+    std::vector<json_path_t> json_paths;
+    std::vector<string_t> functions; // names of the functions called, builtins and user functions
+    uint32_t num_registers = 0; // constants plus the deepest operand stack, contexts allocate them once
+    uint32_t result = 0;
+
+    // every value is a number, the code can run over num_t registers initialized with num_constants
+    bool numeric = false;
+    // the constants are numbers and the instructions are the ones of numeric programs, so the code
+    // gives the same results over num_t registers as long as every variable holds a number
+    bool numeric_code = false;
+    std::vector<num_t> num_constants;
+
+    bool empty() const noexcept { return num_registers == 0; }
+};
+
+// storage a variable slot reads from, owned by the caller (or by the variables map)
+struct slot_binding_t
+{
+    binding_kind kind = binding_kind::NONE;
+    const void *ptr = nullptr;
+};
+
+// native translation of a numeric program (JIT or AOT), regs is the num_t register file with the constants loaded
+using native_entry_t = num_t (*)(num_t *regs, const slot_binding_t *slots);
@@ -0,0 +1,106 @@
+#include "my_expr_cache.h"
+
+expr_cache::expr_cache(size_t capacity, size_t num_shards)
+    : shard_capacity_(std::max<size_t>(1, (capacity + std::max<size_t>(num_shards, 1) - 1) / std::max<size_t>(num_shards, 1))),
+      shards_(std::max<size_t>(num_shards, 1)),
+      functions_(std::make_shared<const std::unordered_map<string_t, f_function_info>>())
+{
+}
+
+expr_cache &expr_cache::global()
+{
+    static expr_cache cache;
+    return cache;
+}
+
+expr_cache::shard_t &expr_cache::shard_for(const string_t &expression)
+{
+    return shards_[std::hash<string_t>()(expression) % shards_.size()];
+}
+
+compiled_expr_ptr expr_cache::get(const string_t &expression)
+{
+    auto compiled = this->try_get(expression);
+    return compiled ? *compiled : expr::empty_compiled();
+}
+
+expr_result<compiled_expr_ptr> expr_cache::try_get(const string_t &expression)
+{
+    auto &shard = this->shard_for(expression);
+    uint64_t version = this->functions_version();
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.entries.find(expression);
+        if (it != shard.entries.end() && it->second.version == version)
+        {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lru);
+            this->hits_.fetch_add(1, std::memory_order_relaxed);
+            return it->second.compiled;
+        }
+    }
+    this->misses_.fetch_add(1, std::memory_order_relaxed);
+
+    // compiled without holding the lock, two threads missing the same expression both compile it
+    std::shared_ptr<const std::unordered_map<string_t, f_function_info>> functions;
+    {
+        std::lock_guard<std::mutex> lock(this->functions_mutex_);
+        functions = this->functions_;
+        version = this->functions_version();
+    }
+    expr compiler(expression);
+    compiler.set_functions(*functions);
+    auto compiled = compiler.try_compile();
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.entries.find(expression);
+    if (it != shard.entries.end())
+    {
+        // an older version, or the program of another thread that missed at the same time
+        if (it->second.version < version)
+        {
+            it->second.version = version;
+            it->second.compiled = compiled;
+        }
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lru);
+        return it->second.compiled;
+    }
+
+    shard.lru.push_front(expression);
+    shard.entries.emplace(expression, entry_t{version, compiled, shard.lru.begin()});
+    while (shard.entries.size() > this->shard_capacity_)
+    {
+        shard.entries.erase(shard.lru.back());
+        shard.lru.pop_back();
+        this->evictions_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return compiled;
+}
+
+void expr_cache::set_functions(const std::unordered_map<string_t, f_function_info> &functions)
+{
+    auto registry = std::make_shared<const std::unordered_map<string_t, f_function_info>>(functions);
+    std::lock_guard<std::mutex> lock(this->functions_mutex_);
+    this->functions_ = std::move(registry);
+    this->version_.fetch_add(1, std::memory_order_acq_rel);
+}
+
+void expr_cache::clear()
+{
+    for (auto &shard : this->shards_)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.entries.clear();
+        shard.lru.clear();
+    }
+}
+
+size_t expr_cache::size() const
+{
+    size_t size = 0;
+    for (const auto &shard : this->shards_)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        size += shard.entries.size();
+    }
+    return size;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "my_expr.h"
+
+// Process-wide cache of compiled expressions, keyed by the expression text and the version of
+// the function registry they were compiled with. Entries are shared compiled programs, to be
+// evaluated with an eval_context. The cache is split in shards, each with its own lock and its
+// own LRU list, so concurrent lookups of different expressions rarely wait on each other.
+// Programs are compiled without bindings, so they are not specialized for number variables.
+class expr_cache
+{
+public:
+    explicit expr_cache(size_t capacity = 4096, size_t num_shards = 16);
+
+    // cache used by expr::eval(const string_t &)
+    static expr_cache &global();
+
+    // compiled program of the expression, compiled with the registry functions on a miss.
+    // An expression that does not compile is cached with its error, like a program, so looking
+    // it up again does not compile it again
+    expr_result<compiled_expr_ptr> try_get(const string_t &expression);
+    // same, the program of an expression that does not compile is empty
+    compiled_expr_ptr get(const string_t &expression);
+
+    // user functions the expressions are compiled with, replacing them starts a new version
+    // and the entries compiled with the previous one are compiled again when requested
+    void set_functions(const std::unordered_map<string_t, f_function_info> &functions);
+    uint64_t functions_version() const noexcept { return version_.load(std::memory_order_acquire); }
+
+    void clear();
+    size_t size() const;
+    size_t capacity() const noexcept { return shard_capacity_ * shards_.size(); }
+
+    uint64_t hits() const noexcept { return hits_.load(std::memory_order_relaxed); }
+    uint64_t misses() const noexcept { return misses_.load(std::memory_order_relaxed); }
+    uint64_t evictions() const noexcept { return evictions_.load(std::memory_order_relaxed); }
+
+private:
+    struct entry_t
+    {
+        uint64_t version;
+        expr_result<compiled_expr_ptr> compiled;
+        std::list<string_t>::iterator lru; // position in the LRU list of the shard
+    };
+
+    struct shard_t
+    {
+        mutable std::mutex mutex;
+        std::unordered_map<string_t, entry_t> entries;
+        std::list<string_t> lru; // most recently used first
+    };
+
+    size_t shard_capacity_;
+    std::vector<shard_t> shards_;
+
+    std::mutex functions_mutex_;
+    std::shared_ptr<const std::unordered_map<string_t, f_function_info>> functions_;
+    std::atomic<uint64_t> version_{0};
+
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> evictions_{0};
+
+    shard_t &shard_for(const string_t &expression);
+};
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include <string>
 #include <variant>
 #include "json.hpp"
@@ -21,6 +22,9 @@ using json_t = nlohmann::json;
 
 using token_data_t = std::variant<num_t, string_t, json_t>;
 
+// document read by any number of expressions and threads without being copied, see bind()
+using shared_json_t = std::shared_ptr<const json_t>;
+
 enum class data_type
 {
     NUMBER,
@@ -30,6 +34,15 @@ enum class data_type
     NULL_TYPE
 };
 
+// type of a value known at compile time, in the same order as token_data_t
+enum class value_type
+{
+    ANY,
+    NUMBER,
+    STRING,
+    JSON
+};
+
 enum class token_types
 {
     LITERAL,
@@ -63,6 +76,10 @@ using function_resolver_t = std::function<token_data_t(const std::string_view &s
 // math functions that can be used in the expression (needs to be validated that are numbers)
 using m_generic_function = num_t (*)(const num_t *args);
 
+// column version of a math function, out[i] = f(args[0][i], ..., args[k - 1][i]) for i < n,
+// out does not overlap the arguments
+using m_column_function = void (*)(const num_t *const *args, num_t *out, size_t n);
+
 struct m_function_info
 {
     m_generic_function func;
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <variant>
+
+#include "my_expr_dtypes.h"
+
+enum class expr_errc : uint8_t
+{
+    OK,
+    SYNTAX,              // invalid character, literal, operator or grouping
+    NOT_ENOUGH_OPERANDS, // operator or function without all its operands
+    UNDEFINED_FUNCTION,
+    UNDEFINED_VARIABLE,  // not bound, not set and no resolver
+    TYPE_MISMATCH,       // variable bound to another type than the one the program was compiled for
+    NOT_COMPILED,
+    ASYNC_FUNCTION,      // asynchronous function reached outside eval_async()
+    FUNCTION_ERROR,      // a user function, a resolver or an operation on a json value threw
+    TOO_LARGE            // more registers, variables or instructions than an instruction can address
+};
+
+struct expr_error
+{
+    static constexpr size_t no_position = static_cast<size_t>(-1);
+
+    expr_errc code = expr_errc::OK;
+    size_t position = no_position; // offset in the expression text
+    string_t symbol;  // variable or function the error is about
+    string_t message; // only for the errors that are reported as exceptions by compile() and eval()
+};
+
+// error of the throwing API, carries the same code and position
+class expr_exception : public std::runtime_error
+{
+public:
+    expr_exception(expr_errc code, size_t position, const string_t &message)
+        : std::runtime_error(message), code_(code), position_(position) {}
+
+    expr_errc code() const noexcept { return code_; }
+    size_t position() const noexcept { return position_; }
+
+private:
+    expr_errc code_;
+    size_t position_;
+};
+
+// value or error of try_compile() and try_eval()
+template <typename T>
+class expr_result
+{
+public:
+    expr_result(T value) : value_(std::move(value)) {}
+    expr_result(expr_error error) : value_(std::move(error)) {}
+
+    bool has_value() const noexcept { return value_.index() == 0; }
+    explicit operator bool() const noexcept { return has_value(); }
+
+    const T &value() const { return std::get<0>(value_); }
+    const T &operator*() const { return std::get<0>(value_); }
+    const T *operator->() const { return &std::get<0>(value_); }
+    const expr_error &error() const { return std::get<1>(value_); }
+
+private:
+    std::variant<T, expr_error> value_;
+};
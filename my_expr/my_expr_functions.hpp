@@ -23,6 +23,27 @@
 namespace m_parser_builtins
 {
 
+	// convert a single argument to a number, strings are parsed and non numeric values are NaN
+	inline num_t m_argument_to_number(const token_data_t &arg)
+	{
+		if (arg.index() == 0)
+		{
+			return std::get<num_t>(arg);
+		}
+		// try to convert string to number
+		else if (arg.index() == 1)
+		{
+			return stringToNumber2(std::get<string_t>(arg));
+		}
+		// convert the json to a number
+		const auto &j = std::get<nlohmann::json>(arg);
+		if (json_is_number(j))
+		{
+			return j.get<num_t>();
+		}
+		return std::numeric_limits<double>::quiet_NaN();
+	}
+
 	// generic m_function type validator (check that all the args variant are a number)
 	// return the arguments as a vector of doubles
 	inline std::vector<num_t> m_function_validator(const token_data_t *args, const int num_args, const int expected_args)
@@ -38,32 +59,7 @@ namespace m_parser_builtins
 		std::vector<num_t> result;
 		for (int i = 0; i < num_args; i++)
 		{
-
-			if (args[i].index() == 0)
-			{
-				result.push_back(std::get<num_t>(args[i]));
-				continue;
-			}
-			// try to convert string to number
-			else if (args[i].index() == 1)
-			{
-				result.push_back(stringToNumber2(std::get<string_t>(args[i])));
-				continue;
-			}
-			else if (args[i].index() == 2)
-			{
-				// convert the json to a number
-				auto j = std::get<nlohmann::json>(args[i]);
-				if (json_is_number(j))
-				{
-					result.push_back(j.get<num_t>());
-				}
-				else
-				{
-					result.push_back(std::numeric_limits<double>::quiet_NaN());
-				}
-				continue;
-			}
+			result.push_back(m_argument_to_number(args[i]));
 		}
 		return result;
 	}
@@ -366,18 +362,17 @@ namespace f_parser_builtins
 	{
 		if (args[0].index() == 1 && args[1].index() == 1)
 		{
-			auto s = std::get<string_t>(args[0]);
-			auto delim = std::get<string_t>(args[1]);
-			std::vector<string_t> result;
-			size_t pos = 0;
-			std::string token;
-			while ((pos = s.find(delim)) != std::string::npos)
+			// the pieces are copied once, straight into the array
+			const auto &s = std::get<string_t>(args[0]);
+			const auto &delim = std::get<string_t>(args[1]);
+			json_t result = json_t::array();
+			size_t start = 0, pos;
+			while (!delim.empty() && (pos = s.find(delim, start)) != std::string::npos)
 			{
-				token = s.substr(0, pos);
-				result.push_back(token);
-				s.erase(0, pos + delim.length());
+				result.emplace_back(s.substr(start, pos - start));
+				start = pos + delim.length();
 			}
-			result.push_back(s);
+			result.emplace_back(s.substr(start));
 			return result;
 		}
 		return json_t();
@@ -387,12 +382,13 @@ namespace f_parser_builtins
 	{
 		if (args[0].index() == 2 && args[1].index() == 1)
 		{
-			auto j = std::get<json_t>(args[0]);
-			auto delim = std::get<string_t>(args[1]);
+			const auto &j = std::get<json_t>(args[0]);
+			const auto &delim = std::get<string_t>(args[1]);
 			string_t result = "";
 			for (auto &v : j)
 			{
-				result += v.get<string_t>() + delim;
+				result += v.get_ref<const string_t &>();
+				result += delim;
 			}
 			if (result.size() > 0)
 			{
@@ -682,13 +678,13 @@ namespace f_parser_builtins
 	{
 		if (args[0].index() == 2)
 		{
-			auto j = std::get<json_t>(args[0]);
+			const auto &j = std::get<json_t>(args[0]);
 			if (j.is_object())
 			{
-				std::vector<string_t> keys;
+				json_t keys = json_t::array();
 				for (auto it = j.begin(); it != j.end(); ++it)
 				{
-					keys.push_back(it.key());
+					keys.emplace_back(it.key());
 				}
 				return keys;
 			}
@@ -700,10 +696,10 @@ namespace f_parser_builtins
 	{
 		if (args[0].index() == 2)
 		{
-			auto j = std::get<json_t>(args[0]);
+			const auto &j = std::get<json_t>(args[0]);
 			if (j.is_object())
 			{
-				std::vector<json_t> values;
+				json_t values = json_t::array();
 				for (auto it = j.begin(); it != j.end(); ++it)
 				{
 					values.push_back(it.value());
@@ -739,6 +735,33 @@ namespace f_parser_builtins
 		{"sort", {f_parser_builtins::sort_f, 1}},
 		{"keys", {f_parser_builtins::keys_f, 1}},
 		{"values", {f_parser_builtins::values_f, 1}}};
+
+	// type of the value returned by each function, used for type inference
+	const std::unordered_map<string_t, value_type> return_types = {
+		{"toNum", value_type::NUMBER},
+		{"toStr", value_type::STRING},
+		{"toJson", value_type::JSON},
+		{"len", value_type::NUMBER},
+		{"sum", value_type::NUMBER},
+		{"capitalize", value_type::STRING},
+		{"lower", value_type::STRING},
+		{"upper", value_type::STRING},
+		{"split", value_type::JSON},
+		{"join", value_type::STRING},
+		{"replace", value_type::STRING},
+		{"find", value_type::NUMBER},
+		{"count", value_type::NUMBER},
+		{"startswith", value_type::NUMBER},
+		{"endswith", value_type::NUMBER},
+		{"isalnum", value_type::NUMBER},
+		{"isalpha", value_type::NUMBER},
+		{"isdigit", value_type::NUMBER},
+		{"isnan", value_type::NUMBER},
+		{"isinf", value_type::NUMBER},
+		{"reverse", value_type::ANY},
+		{"sort", value_type::JSON},
+		{"keys", value_type::JSON},
+		{"values", value_type::JSON}};
 }
 
 namespace operators_builtins
@@ -751,6 +774,12 @@ namespace operators_builtins
 		json_t = 2
 	};
 
+	// numbers in concatenations, integers are written without decimals
+	inline string_t num_to_string(num_t num)
+	{
+		return (std::floor(num) == num) ? std::to_string(static_cast<int64_t>(num)) : std::to_string(num);
+	}
+
 	inline token_data_t add_f(const token_data_t &a, const token_data_t &b)
 	{
 		auto typeA = static_cast<op_data_types>(a.index());
@@ -763,12 +792,6 @@ namespace operators_builtins
 		// case 5: number + json_t => if json_t is a number, sum, else if is an array, push_back, if is string concatenate else if is an object, error
 		// case 7: string + json_t => if json_t is a number, concatenate, else if is an array, push_back, if is string concatenate else if is an object, error
 
-		// Helper function to convert numbers to strings, handling integers cleanly
-		auto num_to_string = [](num_t num)
-		{
-			return (std::floor(num) == num) ? std::to_string(static_cast<int64_t>(num)) : std::to_string(num);
-		};
-
 		if (typeA == op_data_types::NUMBER && typeB == op_data_types::NUMBER)
 		{
 			return std::get<num_t>(a) + std::get<num_t>(b);
@@ -987,6 +1010,34 @@ namespace operators_builtins
 		return check_operands ? token_data_t((num_t)(a <= b)) : std::numeric_limits<num_t>::quiet_NaN();
 	}
 
+	// truthiness used by &&, || and conditionals
+	inline bool truthy_f(const token_data_t &a)
+	{
+		switch ((op_data_types)a.index())
+		{
+		case op_data_types::NUMBER:
+			return std::get<num_t>(a) != 0;
+		case op_data_types::STRING:
+			return std::get<string_t>(a) != "";
+		default:
+			return !std::get<json_t>(a).empty();
+		}
+	}
+
+	// result of a && b when a is falsy
+	inline token_data_t falsy_f(const token_data_t &a)
+	{
+		switch ((op_data_types)a.index())
+		{
+		case op_data_types::NUMBER:
+			return (num_t)0;
+		case op_data_types::STRING:
+			return string_t("");
+		default:
+			return json_t();
+		}
+	}
+
 	inline token_data_t and_f(const token_data_t &a, const token_data_t &b)
 	{
 		auto typeA = (op_data_types)a.index();
@@ -1054,23 +1105,36 @@ namespace operators_builtins
 		}
 	}
 
-	inline token_data_t access_f(const token_data_t &a, const token_data_t &b)
+	// a.b and a[b] on a json taken by reference, the json is not copied
+	inline token_data_t access_json(const json_t &a, const token_data_t &b)
 	{
-		auto typeA = (op_data_types)a.index();
-		auto typeB = (op_data_types)b.index();
+		if ((op_data_types)b.index() != op_data_types::STRING)
+		{
+			return std::numeric_limits<num_t>::quiet_NaN();
+		}
+		auto it = a.find(std::get<string_t>(b));
+		return it != a.end() ? token_data_t(*it) : token_data_t(json_t());
+	}
 
-		if (typeA == op_data_types::json_t && typeB == op_data_types::STRING)
+	inline token_data_t index_json(const json_t &a, const token_data_t &b)
+	{
+		if ((op_data_types)b.index() != op_data_types::NUMBER)
 		{
-			auto jsonA = std::get<json_t>(a);
-			auto key = std::get<string_t>(b);
-			if (jsonA.contains(key))
-			{
-				return jsonA[key];
-			}
-			else
-			{
-				return json_t();
-			}
+			return std::numeric_limits<num_t>::quiet_NaN();
+		}
+		auto index = static_cast<int>(std::get<num_t>(b));
+		if (a.is_array() && index >= 0 && index < (int)a.size())
+		{
+			return a[index];
+		}
+		return json_t();
+	}
+
+	inline token_data_t access_f(const token_data_t &a, const token_data_t &b)
+	{
+		if ((op_data_types)a.index() == op_data_types::json_t)
+		{
+			return access_json(std::get<json_t>(a), b);
 		}
 		else
 		{
@@ -1083,24 +1147,15 @@ namespace operators_builtins
 		auto typeA = (op_data_types)a.index();
 		auto typeB = (op_data_types)b.index();
 
-		if (typeA == op_data_types::json_t && typeB == op_data_types::NUMBER)
+		if (typeA == op_data_types::json_t)
 		{
-			auto jsonA = std::get<json_t>(a);
-			auto index = static_cast<int>(std::get<num_t>(b));
-			if (jsonA.is_array() && index >= 0 && index < jsonA.size())
-			{
-				return jsonA[index];
-			}
-			else
-			{
-				return json_t();
-			}
+			return index_json(std::get<json_t>(a), b);
 		}
 		else if (typeA == op_data_types::STRING && typeB == op_data_types::NUMBER)
 		{
-			auto strA = std::get<string_t>(a);
+			const auto &strA = std::get<string_t>(a);
 			auto index = static_cast<int>(std::get<num_t>(b));
-			if (index >= 0 && index < strA.size())
+			if (index >= 0 && index < (int)strA.size())
 			{
 				return string_t(1, strA[index]);
 			}
@@ -0,0 +1,344 @@
+#include "my_expr_jit.h"
+
+#include <cmath>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__)) && !defined(EXPR_NO_JIT)
+#define EXPR_JIT_X86_64
+#include <sys/mman.h>
+#endif
+
+#ifdef EXPR_JIT_X86_64
+
+#pragma region emitter
+
+// registers used by the generated code:
+//  rbx = num_t *regs, r12 = const slot_binding_t *slots (both callee saved, so they survive the calls)
+//  xmm0, xmm1 = scratch, rax, rcx = scratch
+class x86_64_emitter
+{
+public:
+    std::vector<uint8_t> code;
+
+    void bytes(std::initializer_list<uint8_t> b) { code.insert(code.end(), b); }
+
+    void imm32(uint32_t v)
+    {
+        for (int i = 0; i < 4; i++)
+            code.push_back(static_cast<uint8_t>(v >> (8 * i)));
+    }
+
+    void imm64(uint64_t v)
+    {
+        for (int i = 0; i < 8; i++)
+            code.push_back(static_cast<uint8_t>(v >> (8 * i)));
+    }
+
+    static uint32_t reg(uint32_t r) { return r * sizeof(num_t); }
+
+    // <prefix> 0F <op> xmm, [rbx + disp32]
+    void sse_rbx(uint8_t prefix, uint8_t op, int xmm, uint32_t disp)
+    {
+        bytes({prefix, 0x0F, op, static_cast<uint8_t>(0x83 | (xmm << 3))});
+        imm32(disp);
+    }
+
+    void load(int xmm, uint32_t r) { sse_rbx(0xF2, 0x10, xmm, reg(r)); }  // movsd xmm, [rbx + r]
+    void store(int xmm, uint32_t r) { sse_rbx(0xF2, 0x11, xmm, reg(r)); } // movsd [rbx + r], xmm
+    void arith(uint8_t op, uint32_t r) { sse_rbx(0xF2, op, 0, reg(r)); }  // <op>sd xmm0, [rbx + r]
+    void ucomisd(uint32_t r) { sse_rbx(0x66, 0x2E, 0, reg(r)); }        // ucomisd xmm0, [rbx + r]
+
+    void zero_xmm1() { bytes({0x66, 0x0F, 0x57, 0xC9}); }      // xorpd xmm1, xmm1
+    void ucomisd_xmm1() { bytes({0x66, 0x0F, 0x2E, 0xC1}); }   // ucomisd xmm0, xmm1
+    void setcc_al(uint8_t cc) { bytes({0x0F, cc, 0xC0}); }      // setcc al
+    void setcc_cl(uint8_t cc) { bytes({0x0F, cc, 0xC1}); }      // setcc cl
+    void and_al_cl() { bytes({0x20, 0xC8}); }                   // and al, cl
+    void or_al_cl() { bytes({0x08, 0xC8}); }                    // or al, cl
+
+    // xmm0 = (num_t)al
+    void bool_to_xmm0() { bytes({0x0F, 0xB6, 0xC0, 0xF2, 0x0F, 0x2A, 0xC0}); } // movzx eax, al; cvtsi2sd xmm0, eax
+
+    // rax = slots[slot].ptr; xmm0 = *rax
+    void load_slot(uint32_t slot)
+    {
+        bytes({0x49, 0x8B, 0x84, 0x24}); // mov rax, [r12 + disp32]
+        imm32(static_cast<uint32_t>(slot * sizeof(slot_binding_t) + offsetof(slot_binding_t, ptr)));
+        bytes({0xF2, 0x0F, 0x10, 0x00}); // movsd xmm0, [rax]
+    }
+
+    void call(const void *fn)
+    {
+        bytes({0x48, 0xB8}); // mov rax, imm64
+        imm64(reinterpret_cast<uint64_t>(fn));
+        bytes({0xFF, 0xD0}); // call rax
+    }
+
+    // lea rdi, [rbx + r]
+    void lea_rdi(uint32_t r)
+    {
+        bytes({0x48, 0x8D, 0xBB});
+        imm32(reg(r));
+    }
+
+    // jmp / jcc rel32 to a label patched later, returns the position of the displacement
+    size_t jump(uint8_t cc = 0)
+    {
+        if (cc == 0)
+            bytes({0xE9});
+        else
+            bytes({0x0F, cc});
+        imm32(0);
+        return code.size() - 4;
+    }
+
+    void patch(size_t at, size_t target)
+    {
+        uint32_t rel = static_cast<uint32_t>(static_cast<int64_t>(target) - static_cast<int64_t>(at + 4));
+        std::memcpy(&code[at], &rel, 4);
+    }
+};
+
+// condition codes for setcc (0F 9x) and jcc (0F 8x)
+constexpr uint8_t CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7, CC_AE = 0x3, CC_P = 0xA, CC_NP = 0xB;
+
+static double jit_fmod(double a, double b) { return std::fmod(a, b); }
+static double jit_pow(double a, double b) { return std::pow(a, b); }
+
+// r[dst] = r[a] <op> r[b] for ADD ... GTE, comparisons are false when an operand is NaN, except !=
+static void emit_binary(x86_64_emitter &e, opcode op, uint32_t dst, uint32_t a, uint32_t b)
+{
+    if (op == opcode::ADD || op == opcode::SUB || op == opcode::MUL || op == opcode::DIV)
+    {
+        e.load(0, a);
+        e.arith(op == opcode::ADD ? 0x58 : op == opcode::SUB ? 0x5C
+                                     : op == opcode::MUL   ? 0x59
+                                                           : 0x5E,
+                b);
+        e.store(0, dst);
+        return;
+    }
+    if (op == opcode::MOD || op == opcode::POW)
+    {
+        e.load(0, a);
+        e.load(1, b);
+        e.call(reinterpret_cast<const void *>(op == opcode::MOD ? jit_fmod : jit_pow));
+        e.store(0, dst);
+        return;
+    }
+
+    if (op == opcode::EQ || op == opcode::NEQ)
+    {
+        e.load(0, a);
+        e.ucomisd(b);
+        if (op == opcode::EQ)
+        {
+            e.setcc_al(0x90 | CC_E);
+            e.setcc_cl(0x90 | CC_NP);
+            e.and_al_cl();
+        }
+        else
+        {
+            e.setcc_al(0x90 | CC_NE);
+            e.setcc_cl(0x90 | CC_P);
+            e.or_al_cl();
+        }
+    }
+    else
+    {
+        // a < b is b > a, "above" conditions are false for unordered operands
+        bool swap = op == opcode::LT || op == opcode::LTE;
+        e.load(0, swap ? b : a);
+        e.ucomisd(swap ? a : b);
+        e.setcc_al(0x90 | (op == opcode::LT || op == opcode::GT ? CC_A : CC_AE));
+    }
+    e.bool_to_xmm0();
+    e.store(0, dst);
+}
+
+static bool emit_program(const program_t &program, x86_64_emitter &e)
+{
+    const auto &code = program.code;
+    std::vector<size_t> offsets(code.size() + 1);
+    std::vector<std::pair<size_t, uint32_t>> jumps; // displacement position, target instruction
+
+    // prologue, after the three pushes the stack is 16 byte aligned for the calls
+    e.bytes({0x53, 0x41, 0x54, 0x41, 0x55}); // push rbx; push r12; push r13
+    e.bytes({0x48, 0x89, 0xFB});             // mov rbx, rdi
+    e.bytes({0x49, 0x89, 0xF4});             // mov r12, rsi
+
+    for (size_t pc = 0; pc < code.size(); pc++)
+    {
+        offsets[pc] = e.code.size();
+        const auto &ins = code[pc];
+        switch (ins.op)
+        {
+        case opcode::LOAD_VAR:
+            e.load_slot(ins.a);
+            e.store(0, ins.dst);
+            break;
+        case opcode::LOAD_VAR2:
+        case opcode::LOAD_VAR3:
+            e.load_slot(ins.a);
+            e.store(0, ins.dst);
+            e.load_slot(ins.b);
+            e.store(0, ins.dst + 1);
+            if (ins.op == opcode::LOAD_VAR3)
+            {
+                e.load_slot(ins.c);
+                e.store(0, ins.dst + 2);
+            }
+            break;
+        case opcode::MOVE:
+            e.load(0, ins.a);
+            e.store(0, ins.dst);
+            break;
+        case opcode::CALL_M:
+            // m functions take a pointer to their arguments, which are consecutive registers
+            e.lea_rdi(ins.a);
+            e.call(reinterpret_cast<const void *>(program.m_functions[ins.c].func));
+            e.store(0, ins.dst);
+            break;
+
+        case opcode::JUMP:
+            jumps.push_back({e.jump(), ins.c});
+            break;
+        case opcode::JUMP_IF_FALSE:
+            // NaN is true, only an ordered 0 jumps
+            e.load(0, ins.a);
+            e.zero_xmm1();
+            e.ucomisd_xmm1();
+            e.bytes({0x7A, 0x06}); // jp +6 (over the je)
+            jumps.push_back({e.jump(0x80 | CC_E), ins.c});
+            break;
+        case opcode::AND_JUMP:
+            // if (a == 0) { dst = 0; goto c }
+            e.load(0, ins.a);
+            e.zero_xmm1();
+            e.ucomisd_xmm1();
+            e.bytes({0x7A, 0x0F}); // jp +15
+            e.bytes({0x75, 0x0D}); // jne +13
+            e.store(1, ins.dst);   // 8 bytes
+            jumps.push_back({e.jump(), ins.c}); // 5 bytes
+            break;
+        case opcode::OR_JUMP:
+            // if (a != 0) { dst = a; goto c }
+            e.load(0, ins.a);
+            e.zero_xmm1();
+            e.ucomisd_xmm1();
+            e.bytes({0x7A, 0x02}); // jp +2 (NaN is true)
+            e.bytes({0x74, 0x0D}); // je +13
+            e.store(0, ins.dst);
+            jumps.push_back({e.jump(), ins.c});
+            break;
+
+        case opcode::ADD:
+        case opcode::SUB:
+        case opcode::MUL:
+        case opcode::DIV:
+        case opcode::MOD:
+        case opcode::POW:
+        case opcode::EQ:
+        case opcode::NEQ:
+        case opcode::LT:
+        case opcode::LTE:
+        case opcode::GT:
+        case opcode::GTE:
+            emit_binary(e, ins.op, ins.dst, ins.a, ins.b);
+            break;
+        case opcode::NOT:
+            e.load(0, ins.a);
+            e.zero_xmm1();
+            e.ucomisd_xmm1();
+            e.setcc_al(0x90 | CC_E);
+            e.setcc_cl(0x90 | CC_NP);
+            e.and_al_cl();
+            e.bool_to_xmm0();
+            e.store(0, ins.dst);
+            break;
+
+        case opcode::MUL_ADD:
+            // mulsd and addsd, rounded twice like the interpreter
+            e.load(0, ins.a);
+            e.arith(0x59, ins.b);
+            e.arith(0x58, ins.c);
+            e.store(0, ins.dst);
+            break;
+        case opcode::BINARY_VAR:
+            // the variable goes through dst, which is overwritten by the result
+            e.load_slot(ins.a);
+            e.store(0, ins.dst);
+            emit_binary(e, static_cast<opcode>(ins.c), ins.dst, ins.dst, ins.b);
+            break;
+
+        case opcode::RETURN:
+            // epilogue
+            e.load(0, ins.a);
+            e.bytes({0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3}); // pop r13; pop r12; pop rbx; ret
+            break;
+
+        default:
+            return false;
+        }
+    }
+    offsets[code.size()] = e.code.size();
+
+    for (const auto &jump : jumps)
+        e.patch(jump.first, offsets[jump.second]);
+    return true;
+}
+
+#pragma endregion
+
+bool jit_program_t::supported() noexcept
+{
+    return std::is_same<num_t, double>::value;
+}
+
+bool jit_program_t::compile(const program_t &program)
+{
+    if (!supported() || !program.numeric)
+        return false;
+
+    x86_64_emitter e;
+    if (!emit_program(program, e))
+        return false;
+
+    // W^X: the page is written first and then made executable
+    void *memory = mmap(nullptr, e.code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        return false;
+    std::memcpy(memory, e.code.data(), e.code.size());
+    if (mprotect(memory, e.code.size(), PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(memory, e.code.size());
+        return false;
+    }
+
+    memory_ = memory;
+    size_ = e.code.size();
+    entry_ = reinterpret_cast<native_entry_t>(memory);
+    return true;
+}
+
+jit_program_t::~jit_program_t()
+{
+    if (memory_)
+        munmap(memory_, size_);
+}
+
+#else
+
+bool jit_program_t::supported() noexcept
+{
+    return false;
+}
+
+bool jit_program_t::compile(const program_t &)
+{
+    return false;
+}
+
+jit_program_t::~jit_program_t() = default;
+
+#endif
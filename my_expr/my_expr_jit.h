@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "my_expr_bytecode.h"
+
+// Native backend for numeric programs: the bytecode is translated into x86-64 machine code
+// (SSE2 scalar doubles) written to an executable page. The registers stay in memory, so the
+// generated function works on the same register file as expr::run_numeric().
+// On other platforms, or when num_t is not double, compile() returns false and the
+// interpreter keeps being used.
+class jit_program_t
+{
+public:
+    jit_program_t() = default;
+    jit_program_t(const jit_program_t &) = delete;
+    jit_program_t &operator=(const jit_program_t &) = delete;
+    ~jit_program_t();
+
+    static bool supported() noexcept;
+
+    // translate a numeric program, returns false if it can not be done on this platform
+    bool compile(const program_t &program);
+
+    explicit operator bool() const noexcept { return entry_ != nullptr; }
+
+    native_entry_t entry() const noexcept { return entry_; }
+
+private:
+    void *memory_ = nullptr;
+    size_t size_ = 0;
+    native_entry_t entry_ = nullptr;
+};
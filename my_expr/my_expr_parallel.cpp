@@ -0,0 +1,198 @@
+#include "my_expr_parallel.h"
+
+batch_executor::batch_executor(size_t num_threads, size_t morsel_rows)
+    : morsel_rows_(std::max(morsel_rows, batch_block_rows))
+{
+    if (num_threads == 0)
+        num_threads = std::max<unsigned>(1, std::thread::hardware_concurrency());
+    this->queues_ = std::vector<morsel_queue_t>(num_threads);
+    this->contexts_ = std::vector<eval_context>(num_threads);
+    for (size_t i = 0; i + 1 < num_threads; i++)
+        this->threads_.emplace_back(&batch_executor::worker, this, i);
+}
+
+batch_executor::~batch_executor()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->stop_ = true;
+    }
+    this->start_.notify_all();
+    for (auto &thread : this->threads_)
+        thread.join();
+}
+
+batch_executor &batch_executor::global()
+{
+    static batch_executor executor;
+    return executor;
+}
+
+void batch_executor::eval_batch(const eval_context &context, const columns_t &columns, size_t n_rows, num_t *out)
+{
+    job_t job;
+    job.context = &context;
+    job.n_rows = n_rows;
+    job.eval_rows = [&columns, out](eval_context &worker_context, size_t first, size_t end)
+    { worker_context.eval_rows(columns, first, end, out); };
+    this->run(job);
+}
+
+void batch_executor::eval_batch(const eval_context &context, const columns_t &columns, size_t n_rows, token_data_t *out)
+{
+    job_t job;
+    job.context = &context;
+    job.n_rows = n_rows;
+    job.eval_rows = [&columns, out](eval_context &worker_context, size_t first, size_t end)
+    { worker_context.eval_rows(columns, first, end, out); };
+    this->run(job);
+}
+
+void batch_executor::eval_batch(const compiled_expr_ptr &compiled, const columns_t &columns, size_t n_rows, num_t *out)
+{
+    eval_context context(compiled);
+    this->eval_batch(context, columns, n_rows, out);
+}
+
+void batch_executor::eval_batch(const compiled_expr_ptr &compiled, const columns_t &columns, size_t n_rows, token_data_t *out)
+{
+    eval_context context(compiled);
+    this->eval_batch(context, columns, n_rows, out);
+}
+
+void batch_executor::run(job_t &job)
+{
+    if (!job.context->compiled_ || job.context->compiled_->program().empty())
+        throw std::runtime_error("Expression is not compiled");
+    if (job.n_rows == 0)
+        return;
+
+    std::lock_guard<std::mutex> job_lock(this->job_mutex_);
+
+    // contiguous runs of morsels, so each thread reads its own part of the columns
+    const size_t n_morsels = (job.n_rows + this->morsel_rows_ - 1) / this->morsel_rows_;
+    const size_t n_queues = std::min(this->queues_.size(), n_morsels);
+    for (size_t q = 0; q < n_queues; q++)
+    {
+        // the caller's queue is the last one, it always gets morsels
+        auto &queue = this->queues_[this->queues_.size() - n_queues + q];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        for (size_t m = n_morsels * q / n_queues; m < n_morsels * (q + 1) / n_queues; m++)
+            queue.morsels.push_back(m);
+    }
+
+    const bool parallel = n_queues > 1;
+    if (parallel)
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->job_ = &job;
+        this->active_ = this->threads_.size();
+        this->generation_++;
+    }
+    if (parallel)
+        this->start_.notify_all();
+
+    this->work(job, this->queues_.size() - 1);
+
+    if (parallel)
+    {
+        std::unique_lock<std::mutex> lock(this->mutex_);
+        this->done_.wait(lock, [this]
+                         { return this->active_ == 0; });
+        this->job_ = nullptr;
+    }
+
+    if (job.error)
+    {
+        // a failed job leaves the morsels nobody took
+        for (auto &queue : this->queues_)
+            queue.morsels.clear();
+        std::rethrow_exception(job.error);
+    }
+}
+
+void batch_executor::worker(size_t index)
+{
+    uint64_t generation = 0;
+    while (true)
+    {
+        job_t *job;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex_);
+            this->start_.wait(lock, [&]
+                              { return this->stop_ || this->generation_ != generation; });
+            if (this->stop_)
+                return;
+            generation = this->generation_;
+            job = this->job_;
+        }
+
+        this->work(*job, index);
+
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        if (--this->active_ == 0)
+            this->done_.notify_one();
+    }
+}
+
+void batch_executor::work(job_t &job, size_t index)
+{
+    // scratch of this thread: the registers and batch lanes of its context, kept from one job to the
+    // next, bound like the caller's context. The set_variables values are still read from the caller's.
+    // The program, the bindings and the resolver are released when the job ends
+    auto &context = this->contexts_[index];
+    bool bound = false;
+    size_t morsel;
+    while (!job.failed.load(std::memory_order_relaxed) && this->next_morsel(index, morsel))
+    {
+        try
+        {
+            if (!bound)
+            {
+                context.reset(job.context->compiled_);
+                context.slots_.assign(job.context->slots_.begin(), job.context->slots_.end());
+                context.unknown_var_resolver_ = job.context->unknown_var_resolver_;
+                bound = true;
+            }
+            const size_t first = morsel * this->morsel_rows_;
+            job.eval_rows(context, first, std::min(first + this->morsel_rows_, job.n_rows));
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(job.error_mutex);
+            if (!job.error)
+                job.error = std::current_exception();
+            job.failed.store(true, std::memory_order_relaxed);
+        }
+    }
+    if (bound)
+        context.release();
+}
+
+// own morsels are taken in order from the front, stolen ones from the back of another queue
+bool batch_executor::next_morsel(size_t index, size_t &morsel)
+{
+    {
+        auto &queue = this->queues_[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.morsels.empty())
+        {
+            morsel = queue.morsels.front();
+            queue.morsels.pop_front();
+            return true;
+        }
+    }
+    for (size_t i = 1; i < this->queues_.size(); i++)
+    {
+        auto &queue = this->queues_[(index + i) % this->queues_.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.morsels.empty())
+        {
+            morsel = queue.morsels.back();
+            queue.morsels.pop_back();
+            this->steals_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
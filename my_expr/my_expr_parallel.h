@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "my_expr.h"
+
+// Batch evaluation over a pool of threads. The rows are split in morsels of morsel_rows rows,
+// each thread starts with a contiguous run of morsels and takes them from the front of its own
+// queue; a thread whose queue is empty steals from the back of the others. Every thread
+// evaluates the shared compiled program with its own eval_context (registers and batch lanes),
+// and writes the results in place, so out is in row order whatever thread ran each morsel.
+// Calls on one executor run one after the other; the calling thread works too.
+class batch_executor
+{
+public:
+    // num_threads 0 uses one thread per hardware thread
+    explicit batch_executor(size_t num_threads = 0, size_t morsel_rows = 64 * batch_block_rows);
+    ~batch_executor();
+
+    batch_executor(const batch_executor &) = delete;
+    batch_executor &operator=(const batch_executor &) = delete;
+
+    static batch_executor &global();
+
+    // same as eval_context::eval_batch, the variables without a column keep the binding they have
+    // in context. The context is only read; its values and bound storage must not change during the
+    // call, and its unknown variable resolver is called from every thread
+    void eval_batch(const eval_context &context, const columns_t &columns, size_t n_rows, num_t *out);
+    void eval_batch(const eval_context &context, const columns_t &columns, size_t n_rows, token_data_t *out);
+
+    void eval_batch(const compiled_expr_ptr &compiled, const columns_t &columns, size_t n_rows, num_t *out);
+    void eval_batch(const compiled_expr_ptr &compiled, const columns_t &columns, size_t n_rows, token_data_t *out);
+
+    size_t num_threads() const noexcept { return threads_.size() + 1; }
+    size_t morsel_rows() const noexcept { return morsel_rows_; }
+
+    // morsels taken from the queue of another thread
+    uint64_t steals() const noexcept { return steals_.load(std::memory_order_relaxed); }
+
+private:
+    struct job_t
+    {
+        const eval_context *context;
+        std::function<void(eval_context &, size_t, size_t)> eval_rows; // rows first to end - 1
+        size_t n_rows;
+        std::atomic<bool> failed{false};
+        std::mutex error_mutex;
+        std::exception_ptr error;
+    };
+
+    struct morsel_queue_t
+    {
+        std::mutex mutex;
+        std::deque<size_t> morsels; // morsel i holds the rows from i * morsel_rows
+    };
+
+    size_t morsel_rows_;
+    std::vector<std::thread> threads_;
+    std::vector<morsel_queue_t> queues_; // one per thread, the last one is the caller's
+    std::vector<eval_context> contexts_; // one per thread like queues_, their buffers are reused by every job
+
+    std::mutex job_mutex_; // held for a whole eval_batch call
+    std::mutex mutex_;
+    std::condition_variable start_;
+    std::condition_variable done_;
+    job_t *job_ = nullptr;
+    uint64_t generation_ = 0;
+    size_t active_ = 0; // pool threads still working on job_
+    bool stop_ = false;
+
+    std::atomic<uint64_t> steals_{0};
+
+    void run(job_t &job);
+    void worker(size_t index);
+    void work(job_t &job, size_t index);
+    bool next_morsel(size_t index, size_t &morsel);
+};
@@ -0,0 +1,279 @@
+#include "my_expr_projection.h"
+
+#include <climits>
+
+#pragma region paths
+
+json_projection::json_projection(const std::vector<compiled_expr_ptr> &compiled)
+{
+    for (const auto &c : compiled)
+        this->add(*c);
+}
+
+// node of a member or an element, created empty. Number keys are truncated like INDEX does
+json_projection::node_t &json_projection::child(node_t &node, const token_data_t &key)
+{
+    if (const string_t *name = std::get_if<string_t>(&key))
+    {
+        for (auto &member : node.members)
+        {
+            if (member.first == *name)
+                return member.second;
+        }
+        return node.members.emplace_back(*name, node_t()).second;
+    }
+
+    const auto index = static_cast<size_t>(std::get<num_t>(key));
+    for (auto &element : node.elements)
+    {
+        if (element.first == index)
+            return element.second;
+    }
+    return node.elements.emplace_back(index, node_t()).second;
+}
+
+void json_projection::add(const compiled_expr &compiled)
+{
+    const auto &program = compiled.program();
+    for (const auto &path : program.json_paths)
+    {
+        node_t *node = &child(this->root_, program.names[path.slot]);
+        for (const auto &key : path.keys)
+        {
+            if (node->whole)
+                break;
+            // negative and huge indexes are never found, the array itself is enough
+            if (const num_t *number = std::get_if<num_t>(&key); number && !(*number >= 0 && *number < INT_MAX))
+            {
+                node = nullptr;
+                break;
+            }
+            node = &child(*node, key);
+        }
+        if (node && !node->whole)
+        {
+            node->whole = true;
+            node->members.clear();
+            node->elements.clear();
+        }
+    }
+}
+
+#pragma endregion
+
+#pragma region scanner
+
+// Walks the text of a document, the values that are not read are skipped by matching their
+// brackets and quotes only
+class json_scanner
+{
+public:
+    explicit json_scanner(std::string_view text) : text_(text) {}
+
+    char next()
+    {
+        while (pos_ < text_.size() && (text_[pos_] == ' ' || text_[pos_] == '\t' || text_[pos_] == '\n' || text_[pos_] == '\r'))
+            pos_++;
+        if (pos_ == text_.size())
+            fail();
+        return text_[pos_];
+    }
+
+    void expect(char c)
+    {
+        if (next() != c)
+            fail();
+        pos_++;
+    }
+
+    // consumes c if it is the next character
+    bool accept(char c)
+    {
+        if (next() != c)
+            return false;
+        pos_++;
+        return true;
+    }
+
+    void end()
+    {
+        while (pos_ < text_.size() && (text_[pos_] == ' ' || text_[pos_] == '\t' || text_[pos_] == '\n' || text_[pos_] == '\r'))
+            pos_++;
+        if (pos_ != text_.size())
+            fail();
+    }
+
+    void skip_value()
+    {
+        const char c = next();
+        if (c == '"')
+        {
+            skip_string();
+            return;
+        }
+        if (c != '{' && c != '[')
+        {
+            while (pos_ < text_.size() && text_[pos_] != ',' && text_[pos_] != '}' && text_[pos_] != ']' &&
+                   text_[pos_] != ' ' && text_[pos_] != '\t' && text_[pos_] != '\n' && text_[pos_] != '\r')
+                pos_++;
+            return;
+        }
+
+        size_t depth = 0;
+        do
+        {
+            if (pos_ == text_.size())
+                fail();
+            const char ch = text_[pos_];
+            if (ch == '"')
+                skip_string();
+            else
+            {
+                if (ch == '{' || ch == '[')
+                    depth++;
+                else if (ch == '}' || ch == ']')
+                    depth--;
+                pos_++;
+            }
+        } while (depth > 0);
+    }
+
+    json_t parse_value()
+    {
+        next();
+        const size_t start = pos_;
+        skip_value();
+        return json_t::parse(text_.substr(start, pos_ - start));
+    }
+
+    // key of a member, escaped keys are decoded by the json parser
+    string_t parse_key()
+    {
+        if (next() != '"')
+            fail();
+        const size_t start = pos_;
+        skip_string();
+        auto key = text_.substr(start + 1, pos_ - start - 2);
+        if (key.find('\\') != std::string_view::npos)
+            return json_t::parse(text_.substr(start, pos_ - start)).get<string_t>();
+        return string_t(key);
+    }
+
+    [[noreturn]] void fail() const
+    {
+        throw std::runtime_error("Invalid json at offset " + std::to_string(pos_));
+    }
+
+private:
+    std::string_view text_;
+    size_t pos_ = 0;
+
+    void skip_string()
+    {
+        pos_++;
+        for (;;)
+        {
+            pos_ = text_.find_first_of("\"\\", pos_);
+            if (pos_ == std::string_view::npos)
+            {
+                pos_ = text_.size();
+                fail();
+            }
+            if (text_[pos_] == '"')
+                break;
+            pos_ += 2;
+        }
+        pos_++;
+    }
+};
+
+#pragma endregion
+
+#pragma region parse
+
+template <typename node_t>
+static json_t project(json_scanner &scanner, const node_t &node);
+
+// calls on_member(key, node) for the members of the object that are read, and skips the rest
+template <typename node_t, typename F>
+static void scan_object(json_scanner &scanner, const node_t &node, F &&on_member)
+{
+    scanner.expect('{');
+    if (scanner.accept('}'))
+        return;
+    do
+    {
+        const auto key = scanner.parse_key();
+        scanner.expect(':');
+        auto member = std::find_if(node.members.begin(), node.members.end(), [&key](const auto &m)
+                                   { return m.first == key; });
+        if (member != node.members.end())
+            on_member(key, member->second);
+        else
+            scanner.skip_value();
+    } while (scanner.accept(','));
+    scanner.expect('}');
+}
+
+template <typename node_t>
+static json_t project(json_scanner &scanner, const node_t &node)
+{
+    const char c = scanner.next();
+    if (node.whole || (c != '{' && c != '['))
+        return scanner.parse_value();
+
+    if (c == '{')
+    {
+        json_t result = json_t::object();
+        scan_object(scanner, node, [&](const string_t &key, const node_t &member)
+                    { result[key] = project(scanner, member); });
+        return result;
+    }
+
+    json_t result = json_t::array();
+    scanner.expect('[');
+    if (scanner.accept(']'))
+        return result;
+    size_t index = 0;
+    do
+    {
+        auto element = std::find_if(node.elements.begin(), node.elements.end(), [index](const auto &e)
+                                    { return e.first == index; });
+        if (element != node.elements.end())
+            result[index] = project(scanner, element->second); // the elements before it are null
+        else
+            scanner.skip_value();
+        index++;
+    } while (scanner.accept(','));
+    scanner.expect(']');
+    return result;
+}
+
+json_t json_projection::parse(std::string_view text) const
+{
+    json_scanner scanner(text);
+    if (scanner.next() != '{')
+        throw std::runtime_error("The document must be an object");
+    json_t result = json_t::object();
+    scan_object(scanner, this->root_, [&](const string_t &key, const node_t &member)
+                { result[key] = project(scanner, member); });
+    scanner.end();
+    return result;
+}
+
+std::unordered_map<string_t, token_data_t> json_projection::parse_variables(std::string_view text) const
+{
+    json_scanner scanner(text);
+    if (scanner.next() != '{')
+        throw std::runtime_error("The document must be an object");
+    std::unordered_map<string_t, token_data_t> variables;
+    scan_object(scanner, this->root_, [&](const string_t &key, const node_t &member)
+                {
+        auto &value = variables[key];
+        value = project(scanner, member);
+        json_to_correct_dtype(value); });
+    scanner.end();
+    return variables;
+}
+
+#pragma endregion
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "my_expr.h"
+
+// Reads a json document with only the values a set of compiled expressions use (see
+// program_t::json_paths). The document is an object with a member per variable, like the map of
+// set_variables(). Members and elements no expression reads are skipped by a scanner without being
+// parsed or validated, the values that are read are parsed whole. Array elements before one that
+// is read are null, so the expressions find every element at its index and get the same results
+// as with the whole document.
+// A projection is not modified by parse(), any number of threads can use it
+class json_projection
+{
+public:
+    json_projection() = default;
+    explicit json_projection(const compiled_expr_ptr &compiled) { add(*compiled); }
+    explicit json_projection(const std::vector<compiled_expr_ptr> &compiled);
+
+    // also read the values used by this expression
+    void add(const compiled_expr &compiled);
+
+    json_t parse(std::string_view text) const;
+    // the members of parse(), converted for set_variables()
+    std::unordered_map<string_t, token_data_t> parse_variables(std::string_view text) const;
+
+private:
+    // part of the document that is read, a value is parsed whole or only its members and elements
+    struct node_t
+    {
+        bool whole = false;
+        std::vector<std::pair<string_t, node_t>> members;
+        std::vector<std::pair<size_t, node_t>> elements;
+    };
+
+    node_t root_;
+
+    static node_t &child(node_t &node, const token_data_t &key);
+};
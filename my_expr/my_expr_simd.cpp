@@ -0,0 +1,555 @@
+#include "my_expr_simd.h"
+#include "my_expr_functions.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+
+#if defined(__GNUC__)
+#define EXPR_SIMD_INLINE inline __attribute__((always_inline))
+#else
+#define EXPR_SIMD_INLINE inline
+#endif
+
+// kernels over doubles only, see num_t
+#if !defined(EXPR_FLOAT) && !defined(EXPR_LONG_DOUBLE)
+#define EXPR_SIMD_DOUBLE
+#endif
+
+// on x86-64 every kernel is built for SSE2, AVX2 + FMA and AVX-512
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(EXPR_NO_SIMD)
+#define EXPR_SIMD_X86_64
+#endif
+
+#ifdef EXPR_SIMD_DOUBLE
+
+// the double-double arithmetic below needs every operation rounded on its own. The options only
+// cover the kernels: the inline functions of the headers are built like in the rest of the library,
+// and the kernels call builtins and their own helpers instead of them (std::fabs, min_lane...).
+// sqrt is only vectorized with -fno-math-errno, which can not be set from here (see CMakeLists.txt)
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC optimize("tree-vectorize", "vect-cost-model=dynamic", "fp-contract=off", "no-trapping-math")
+#endif
+
+namespace
+{
+#pragma region double-double
+
+    EXPR_SIMD_INLINE uint64_t as_bits(double x)
+    {
+        uint64_t u;
+        std::memcpy(&u, &x, sizeof(u));
+        return u;
+    }
+
+    EXPR_SIMD_INLINE double as_double(uint64_t u)
+    {
+        double x;
+        std::memcpy(&x, &u, sizeof(x));
+        return x;
+    }
+
+    // unevaluated sum hi + lo, |lo| <= ulp(hi) / 2
+    struct dd_t
+    {
+        double hi;
+        double lo;
+    };
+
+    EXPR_SIMD_INLINE dd_t two_sum(double a, double b)
+    {
+        const double s = a + b;
+        const double v = s - a;
+        return {s, (a - (s - v)) + (b - v)};
+    }
+
+    // |a| >= |b|
+    EXPR_SIMD_INLINE dd_t fast_two_sum(double a, double b)
+    {
+        const double s = a + b;
+        return {s, b - (s - a)};
+    }
+
+    // exact product, a fused multiply-add when the instruction set has it and Dekker's split otherwise
+    template <bool fma>
+    EXPR_SIMD_INLINE dd_t two_prod(double a, double b)
+    {
+        const double p = a * b;
+#if defined(__GNUC__)
+        if (fma)
+            return {p, __builtin_fma(a, b, -p)};
+#endif
+        const double ca = 134217729.0 * a, cb = 134217729.0 * b; // 2^27 + 1
+        const double ah = ca - (ca - a), al = a - ah;
+        const double bh = cb - (cb - b), bl = b - bh;
+        return {p, ((ah * bh - p) + ah * bl + al * bh) + al * bl};
+    }
+
+    EXPR_SIMD_INLINE dd_t dd_add(dd_t a, dd_t b)
+    {
+        const dd_t s = two_sum(a.hi, b.hi);
+        return fast_two_sum(s.hi, s.lo + a.lo + b.lo);
+    }
+
+    template <bool fma>
+    EXPR_SIMD_INLINE dd_t dd_mul(dd_t a, dd_t b)
+    {
+        const dd_t p = two_prod<fma>(a.hi, b.hi);
+        return fast_two_sum(p.hi, p.lo + (a.hi * b.lo + a.lo * b.hi));
+    }
+
+    template <bool fma>
+    EXPR_SIMD_INLINE dd_t dd_mul(dd_t a, double b)
+    {
+        const dd_t p = two_prod<fma>(a.hi, b);
+        return fast_two_sum(p.hi, p.lo + a.lo * b);
+    }
+
+#pragma endregion
+
+#pragma region lanes
+
+    constexpr double shifter = 0x1.8p52; // x + shifter rounds x to an integer held in the low bits
+    constexpr uint64_t shifter_bits = 0x4338000000000000;
+    constexpr double ln2_hi = 0x1.62e42feep-1; // 33 bits, k * ln2_hi is exact for |k| < 2^20
+    constexpr double ln2_lo = 0x1.a39ef35793c76p-33;
+
+    // x = 2^e * m with m in [sqrt(2)/2, sqrt(2)), x positive, finite and normal
+    EXPR_SIMD_INLINE double split_exponent(double x, double &e)
+    {
+        const uint64_t bits = as_bits(x);
+        const uint64_t e_biased = (bits - 0x3fe6a09e667f3bcd + 0x4000000000000000) >> 52; // e + 1024
+        e = as_double(0x4330000000000000 | e_biased) - (0x1p52 + 1024);
+        return as_double(bits - ((e_biased - 1024) << 52));
+    }
+
+    // log(1 + f) = 2 atanh(s) with s = f / (2 + f), |s| < 0.1716, written as
+    // f - f^2 / 2 + s (f^2 / 2 + R(s^2)) (fdlibm). The terms after s^24 are below 2^-60
+    EXPR_SIMD_INLINE double log_lane(double x)
+    {
+        double e;
+        const double f = split_exponent(x, e) - 1;
+        const double s = f / (2 + f), z = s * s;
+        const double r = z * (2.0 / 3 + z * (2.0 / 5 + z * (2.0 / 7 + z * (2.0 / 9 + z * (2.0 / 11 + z * (2.0 / 13 + z * (2.0 / 15 + z * (2.0 / 17 + z * (2.0 / 19 + z * (2.0 / 21 + z * (2.0 / 23)))))))))));
+        const double hfsq = 0.5 * f * f;
+        return e * ln2_hi - ((hfsq - (s * (hfsq + r) + e * ln2_lo)) - f);
+    }
+
+    // log(x) as a double-double for pow, the same series with the leading terms exact
+    template <bool fma>
+    EXPR_SIMD_INLINE dd_t log_dd_lane(double x)
+    {
+        double e;
+        const double f = split_exponent(x, e) - 1; // exact
+
+        // z = f / (2 + f) with one division, 2 + f is a double-double
+        const dd_t den = two_sum(2, f);
+        const double inv = 1 / den.hi;
+        const double q = f * inv;
+        const dd_t qd = two_prod<fma>(q, den.hi);
+        const dd_t z = fast_two_sum(q, (((f - qd.hi) - qd.lo) - q * den.lo) * inv);
+
+        // 2 atanh(z) = 2z + z^3 (2/3 + z^2 t), the terms after z^25 are below 2^-70
+        const dd_t z2 = dd_mul<fma>(z, z);
+        const double w = z2.hi;
+        const double t = 2.0 / 5 + w * (2.0 / 7 + w * (2.0 / 9 + w * (2.0 / 11 + w * (2.0 / 13 + w * (2.0 / 15 + w * (2.0 / 17 + w * (2.0 / 19 + w * (2.0 / 21 + w * (2.0 / 23 + w * (2.0 / 25))))))))));
+        const dd_t two_thirds = {0x1.5555555555555p-1, 0x1.5555555555555p-55};
+        const dd_t series = dd_mul<fma>(dd_mul<fma>(z2, z), dd_add(two_thirds, dd_mul<fma>(z2, t)));
+
+        const dd_t e_ln2 = fast_two_sum(e * ln2_hi, e * ln2_lo);
+        return dd_add(e_ln2, dd_add({2 * z.hi, 2 * z.lo}, series));
+    }
+
+    // exp(x.hi + x.lo), -708 <= x <= 709. x = k ln2 + r with |r| <= ln2 / 2
+    template <bool fma>
+    EXPR_SIMD_INLINE double exp_lane(dd_t x)
+    {
+        const double shifted = x.hi * 0x1.71547652b82fep0 + shifter;
+        const uint64_t k = as_bits(shifted) - shifter_bits;
+        const double kd = shifted - shifter;
+        dd_t r = two_sum(x.hi, -kd * ln2_hi);
+        r = dd_add(r, {-kd * ln2_lo, x.lo});
+
+        // e^r = 1 + r + r^2 / 2 + r^3 p(r), the terms after r^15 / 15! are below 2^-70.
+        // The first three terms are added exactly, r.lo only changes them through r + r^2 / 2
+        const double s = r.hi;
+        const double p = 1.0 / 6 + s * (1.0 / 24 + s * (1.0 / 120 + s * (1.0 / 720 + s * (1.0 / 5040 + s * (1.0 / 40320 + s * (1.0 / 362880 + s * (1.0 / 3628800 + s * (1.0 / 39916800 + s * (1.0 / 479001600 + s * (1.0 / 6227020800 + s * (1.0 / 87178291200 + s * (1.0 / 1307674368000))))))))))));
+        const dd_t half_s2 = two_prod<fma>(s, 0.5 * s);
+        const dd_t one_r = two_sum(1, s);
+        const dd_t sum = two_sum(one_r.hi, half_s2.hi);
+        const double er = sum.hi + (sum.lo + one_r.lo + half_s2.lo + r.lo * (1 + s) + s * s * s * p);
+        return er * as_double((k + 1023) << 52);
+    }
+
+    // pi / 2 split in three 33 bit parts and a tail, n * part is exact for n < 2^20
+    constexpr double pio2_1 = 0x1.921fb544p0;
+    constexpr double pio2_2 = 0x1.0b4611a6p-34;
+    constexpr double pio2_3 = 0x1.3198a2ep-69;
+    constexpr double pio2_3t = 0x1.b839a252049c1p-104;
+    constexpr double trig_limit = 8e5; // n < 2^19
+
+    // sin and cos of y.hi + y.lo, |y| <= pi / 4 (fdlibm kernels)
+    EXPR_SIMD_INLINE double sin_kernel(dd_t y)
+    {
+        const double z = y.hi * y.hi, v = z * y.hi;
+        const double r = 8.33333333332248946124e-03 + z * (-1.98412698298579493134e-04 + z * (2.75573137070700676789e-06 + z * (-2.50507602534068634195e-08 + z * 1.58969099521155010221e-10)));
+        return y.hi - ((z * (0.5 * y.lo - v * r) - y.lo) - v * -1.66666666666666324348e-01);
+    }
+
+    EXPR_SIMD_INLINE double cos_kernel(dd_t y)
+    {
+        const double z = y.hi * y.hi;
+        const double r = z * (4.16666666666666019037e-02 + z * (-1.38888888888741095749e-03 + z * (2.48015872894767294178e-05 + z * (-2.75573143513906633035e-07 + z * (2.08757232129817482790e-09 + z * -1.13596475577881948265e-11)))));
+        const double hz = 0.5 * z, w = 1 - hz;
+        return w + (((1 - w) - hz) + (z * r - y.hi * y.lo));
+    }
+
+    // sin(x) for odd = 0, cos(x) for odd = 1, |x| < trig_limit.
+    // x = n pi/2 + y, sin and cos of x are +-sin or +-cos of y depending on n mod 4
+    EXPR_SIMD_INLINE double sin_cos_lane(double x, uint64_t odd)
+    {
+        const double shifted = x * 0x1.45f306dc9c883p-1 + shifter;
+        const uint64_t n = as_bits(shifted) - shifter_bits + odd;
+        const double fn = shifted - shifter;
+
+        const double r1 = x - fn * pio2_1;
+        const dd_t r2 = two_sum(r1, -fn * pio2_2);
+        const dd_t r3 = two_sum(r2.hi, -fn * pio2_3);
+        const dd_t y = two_sum(r3.hi, (r2.lo + r3.lo) - fn * pio2_3t);
+
+        const uint64_t pick_cos = 0 - (n & 1);
+        const uint64_t bits = (as_bits(cos_kernel(y)) & pick_cos) | (as_bits(sin_kernel(y)) & ~pick_cos);
+        return as_double(bits ^ ((n & 2) << 62));
+    }
+
+    // same as std::min and std::max
+    EXPR_SIMD_INLINE double min_lane(double a, double b)
+    {
+        return b < a ? b : a;
+    }
+
+    EXPR_SIMD_INLINE double max_lane(double a, double b)
+    {
+        return a < b ? b : a;
+    }
+
+    constexpr double min_normal = std::numeric_limits<double>::min();
+    constexpr double max_finite = std::numeric_limits<double>::max();
+
+    // normal positive finite numbers, the others are computed by the scalar function
+    EXPR_SIMD_INLINE bool log_in_range(double x)
+    {
+        return x >= min_normal && x <= max_finite;
+    }
+
+    EXPR_SIMD_INLINE double log_input(double x)
+    {
+        return min_lane(max_lane(x, min_normal), max_finite);
+    }
+
+#pragma endregion
+
+#pragma region kernels
+
+    // The vector loop computes every lane, the lanes out of its range are computed again with the
+    // scalar function. The second loop only compares, so it costs little when nothing is out of range.
+    // fma tells whether the instruction set the kernel is built for has fused multiply-add
+    template <bool fma>
+    EXPR_SIMD_INLINE void sin_v(const num_t *const *args, num_t *out, size_t n)
+    {
+        const double *x = args[0];
+        for (size_t i = 0; i < n; i++)
+            out[i] = sin_cos_lane(x[i], 0);
+        for (size_t i = 0; i < n; i++)
+            if (!(std::fabs(x[i]) < trig_limit))
+                out[i] = std::sin(x[i]);
+    }
+
+    template <bool fma>
+    EXPR_SIMD_INLINE void cos_v(const num_t *const *args, num_t *out, size_t n)
+    {
+        const double *x = args[0];
+        for (size_t i = 0; i < n; i++)
+            out[i] = sin_cos_lane(x[i], 1);
+        for (size_t i = 0; i < n; i++)
+            if (!(std::fabs(x[i]) < trig_limit))
+                out[i] = std::cos(x[i]);
+    }
+
+    template <bool fma>
+    EXPR_SIMD_INLINE void exp_v(const num_t *const *args, num_t *out, size_t n)
+    {
+        const double *x = args[0];
+        for (size_t i = 0; i < n; i++)
+            out[i] = exp_lane<fma>({min_lane(max_lane(x[i], -708.0), 709.0), 0});
+        for (size_t i = 0; i < n; i++)
+            if (!(x[i] >= -708 && x[i] <= 709))
+                out[i] = std::exp(x[i]);
+    }
+
+    template <bool fma>
+    EXPR_SIMD_INLINE void log_v(const num_t *const *args, num_t *out, size_t n)
+    {
+        const double *x = args[0];
+        for (size_t i = 0; i < n; i++)
+            out[i] = log_lane(log_input(x[i]));
+        for (size_t i = 0; i < n; i++)
+            if (!log_in_range(x[i]))
+                out[i] = std::log(x[i]);
+    }
+
+    template <bool fma>
+    EXPR_SIMD_INLINE void log10_v(const num_t *const *args, num_t *out, size_t n)
+    {
+        const double *x = args[0];
+        const dd_t inv_ln10 = {0x1.bcb7b1526e50ep-2, 0x1.95355baaafad3p-57};
+        for (size_t i = 0; i < n; i++)
+        {
+            const dd_t l = dd_mul<fma>(log_dd_lane<fma>(log_input(x[i])), inv_ln10);
+            out[i] = l.hi + l.lo;
+        }
+        for (size_t i = 0; i < n; i++)
+            if (!log_in_range(x[i]))
+                out[i] = std::log10(x[i]);
+    }
+
+    // x^y = exp(y log(x)) with y log(x) kept as a double-double
+    template <bool fma>
+    EXPR_SIMD_INLINE void pow_v(const num_t *const *args, num_t *out, size_t n)
+    {
+        const double *x = args[0], *y = args[1];
+        for (size_t i = 0; i < n; i++)
+        {
+            const dd_t t = dd_mul<fma>(log_dd_lane<fma>(log_input(x[i])), min_lane(max_lane(y[i], -0x1p20), 0x1p20));
+            const double t_hi = min_lane(max_lane(t.hi, -708.0), 709.0);
+            out[i] = exp_lane<fma>({t_hi, t_hi == t.hi ? t.lo : 0});
+        }
+        // a result between e^-708 and e^709 comes from a product that was not clamped
+        for (size_t i = 0; i < n; i++)
+            if (!log_in_range(x[i]) || !(std::fabs(y[i]) <= 0x1p20) || !(out[i] > 0x1.7c8ab2288c9abp-1022 && out[i] < 0x1.d422d2be5dc9bp+1022))
+                out[i] = std::pow(x[i], y[i]);
+    }
+
+    template <bool fma>
+    EXPR_SIMD_INLINE void sqrt_v(const num_t *const *args, num_t *out, size_t n)
+    {
+        const double *x = args[0];
+        for (size_t i = 0; i < n; i++)
+            out[i] = std::sqrt(x[i]);
+    }
+
+    // sqrt(a^2 + b^2) with the sum of squares as a double-double and one correction step of the root.
+    // Without scaling the square of the largest one stays normal while it is in [2^-480, 2^500], the
+    // square of the other one is either normal too or too small to change the result
+    template <bool fma>
+    EXPR_SIMD_INLINE void hypot_v(const num_t *const *args, num_t *out, size_t n)
+    {
+        const double *a = args[0], *b = args[1];
+        for (size_t i = 0; i < n; i++)
+        {
+            const dd_t a2 = two_prod<fma>(a[i], a[i]), b2 = two_prod<fma>(b[i], b[i]);
+            const dd_t sum = two_sum(a2.hi, b2.hi);
+            const dd_t h = fast_two_sum(sum.hi, sum.lo + a2.lo + b2.lo);
+            const double root = std::sqrt(h.hi);
+            const dd_t root2 = two_prod<fma>(root, root);
+            out[i] = root + (((h.hi - root2.hi) - root2.lo) + h.lo) / (2 * root);
+        }
+        for (size_t i = 0; i < n; i++)
+        {
+            const double big = max_lane(std::fabs(a[i]), std::fabs(b[i]));
+            if (!(big >= 0x1p-480 && big <= 0x1p500))
+                out[i] = std::hypot(a[i], b[i]);
+        }
+    }
+
+    template <bool fma>
+    EXPR_SIMD_INLINE void abs_v(const num_t *const *args, num_t *out, size_t n)
+    {
+        const double *x = args[0];
+        for (size_t i = 0; i < n; i++)
+            out[i] = std::fabs(x[i]);
+    }
+
+    template <bool fma>
+    EXPR_SIMD_INLINE void floor_v(const num_t *const *args, num_t *out, size_t n)
+    {
+        const double *x = args[0];
+        for (size_t i = 0; i < n; i++)
+            out[i] = std::floor(x[i]);
+    }
+
+    template <bool fma>
+    EXPR_SIMD_INLINE void ceil_v(const num_t *const *args, num_t *out, size_t n)
+    {
+        const double *x = args[0];
+        for (size_t i = 0; i < n; i++)
+            out[i] = std::ceil(x[i]);
+    }
+
+    template <bool fma>
+    EXPR_SIMD_INLINE void trunc_v(const num_t *const *args, num_t *out, size_t n)
+    {
+        const double *x = args[0];
+        for (size_t i = 0; i < n; i++)
+            out[i] = std::trunc(x[i]);
+    }
+
+    // same as std::max and std::min, a NaN in the first argument is returned as it is
+    template <bool fma>
+    EXPR_SIMD_INLINE void max_v(const num_t *const *args, num_t *out, size_t n)
+    {
+        const double *a = args[0], *b = args[1];
+        for (size_t i = 0; i < n; i++)
+            out[i] = a[i] < b[i] ? b[i] : a[i];
+    }
+
+    template <bool fma>
+    EXPR_SIMD_INLINE void min_v(const num_t *const *args, num_t *out, size_t n)
+    {
+        const double *a = args[0], *b = args[1];
+        for (size_t i = 0; i < n; i++)
+            out[i] = b[i] < a[i] ? b[i] : a[i];
+    }
+
+#pragma endregion
+
+#pragma region dispatch
+
+    // the versions of a kernel, by instruction set
+    struct kernel_set_t
+    {
+        m_column_function sse2;
+        m_column_function avx2;
+        m_column_function avx512;
+    };
+
+#ifdef EXPR_SIMD_X86_64
+#define EXPR_SIMD_KERNEL(name)                                                                              \
+    void name##_sse2(const num_t *const *args, num_t *out, size_t n) { name<false>(args, out, n); }       \
+    __attribute__((target("avx2,fma"))) void name##_avx2(const num_t *const *args, num_t *out, size_t n)  \
+    {                                                                                                     \
+        name<true>(args, out, n);                                                                         \
+    }                                                                                                     \
+    __attribute__((target("avx512f"))) void name##_avx512(const num_t *const *args, num_t *out, size_t n) \
+    {                                                                                                     \
+        name<true>(args, out, n);                                                                         \
+    }                                                                                                     \
+    constexpr kernel_set_t name##_set = {name##_sse2, name##_avx2, name##_avx512};
+#else
+#define EXPR_SIMD_KERNEL(name)                                                                        \
+    void name##_generic(const num_t *const *args, num_t *out, size_t n) { name<false>(args, out, n); } \
+    constexpr kernel_set_t name##_set = {name##_generic, name##_generic, name##_generic};
+#endif
+
+    EXPR_SIMD_KERNEL(sin_v)
+    EXPR_SIMD_KERNEL(cos_v)
+    EXPR_SIMD_KERNEL(exp_v)
+    EXPR_SIMD_KERNEL(log_v)
+    EXPR_SIMD_KERNEL(log10_v)
+    EXPR_SIMD_KERNEL(pow_v)
+    EXPR_SIMD_KERNEL(sqrt_v)
+    EXPR_SIMD_KERNEL(hypot_v)
+    EXPR_SIMD_KERNEL(abs_v)
+    EXPR_SIMD_KERNEL(floor_v)
+    EXPR_SIMD_KERNEL(ceil_v)
+    EXPR_SIMD_KERNEL(trunc_v)
+    EXPR_SIMD_KERNEL(max_v)
+    EXPR_SIMD_KERNEL(min_v)
+
+    enum class isa_t
+    {
+        SSE2,
+        AVX2,
+        AVX512
+    };
+
+    isa_t detect_isa() noexcept
+    {
+#ifdef EXPR_SIMD_X86_64
+        if (__builtin_cpu_supports("avx512f"))
+            return isa_t::AVX512;
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+            return isa_t::AVX2;
+#endif
+        return isa_t::SSE2;
+    }
+
+    m_column_function pick(const kernel_set_t &set) noexcept
+    {
+        static const isa_t isa = detect_isa();
+        return isa == isa_t::AVX512 ? set.avx512 : isa == isa_t::AVX2 ? set.avx2 : set.sse2;
+    }
+
+#pragma endregion
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC pop_options
+#endif
+
+m_column_function simd_builtins::kernel_for(m_generic_function func) noexcept
+{
+    static const std::unordered_map<m_generic_function, m_column_function> kernels = {
+        {m_parser_builtins::sin_f, pick(sin_v_set)},
+        {m_parser_builtins::cos_f, pick(cos_v_set)},
+        {m_parser_builtins::exp_f, pick(exp_v_set)},
+        {m_parser_builtins::log_f, pick(log_v_set)},
+        {m_parser_builtins::log10_f, pick(log10_v_set)},
+        {m_parser_builtins::pow_f, pick(pow_v_set)},
+        {m_parser_builtins::sqrt_f, pick(sqrt_v_set)},
+        {m_parser_builtins::hypot_f, pick(hypot_v_set)},
+        {m_parser_builtins::abs_f, pick(abs_v_set)},
+        {m_parser_builtins::floor_f, pick(floor_v_set)},
+        {m_parser_builtins::ceil_f, pick(ceil_v_set)},
+        {m_parser_builtins::trunc_f, pick(trunc_v_set)},
+        {m_parser_builtins::max_f, pick(max_v_set)},
+        {m_parser_builtins::min_f, pick(min_v_set)}};
+    auto kernel = kernels.find(func);
+    return kernel == kernels.end() ? nullptr : kernel->second;
+}
+
+m_column_function simd_builtins::pow_kernel() noexcept
+{
+    return kernel_for(m_parser_builtins::pow_f);
+}
+
+const char *simd_builtins::isa() noexcept
+{
+#ifdef EXPR_SIMD_X86_64
+    switch (detect_isa())
+    {
+    case isa_t::AVX512:
+        return "avx512f";
+    case isa_t::AVX2:
+        return "avx2";
+    default:
+        return "sse2";
+    }
+#else
+    return "scalar";
+#endif
+}
+
+#else
+
+m_column_function simd_builtins::kernel_for(m_generic_function) noexcept
+{
+    return nullptr;
+}
+
+m_column_function simd_builtins::pow_kernel() noexcept
+{
+    return nullptr;
+}
+
+const char *simd_builtins::isa() noexcept
+{
+    return "scalar";
+}
+
+#endif
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+
+#include "my_expr_dtypes.h"
+
+// Column versions of the numeric builtins, used by batch evaluation: kernel(args, out, n) writes
+// f(args[0][i], ..., args[k - 1][i]) to out[i] for every i < n. The loops are branch free so the
+// compiler vectorizes them; on x86-64 each kernel is built for SSE2, AVX2 + FMA and AVX-512 and
+// the version for the running CPU is picked the first time a kernel is asked for. Define
+// EXPR_NO_SIMD to build a single version.
+//
+// Error bounds against the correctly rounded result, measured over the whole double range
+// (the same on every instruction set):
+//   sqrt, abs, floor, ceil, trunc, min, max   exact (sqrt correctly rounded)
+//   log10                                     < 0.51 ULP
+//   exp, pow                                  < 0.53 ULP
+//   hypot                                     < 0.54 ULP
+//   sin, cos                                  < 0.8 ULP
+//   log                                       < 0.82 ULP
+// Inputs the vector code does not cover (|x| >= 8e5 for sin and cos, subnormal, negative or
+// non finite inputs of log and pow, results that overflow or underflow) are computed with the
+// std:: function, so special values give the same results as the scalar builtins.
+// The kernels are only provided when num_t is double.
+namespace simd_builtins
+{
+    // vectorized kernel of a builtin, nullptr when it only has the scalar version
+    m_column_function kernel_for(m_generic_function func) noexcept;
+
+    // kernel of the ^ operator, same as the one of pow
+    m_column_function pow_kernel() noexcept;
+
+    // instruction set of the kernels picked for this CPU: "avx512f", "avx2", "sse2" or "scalar"
+    const char *isa() noexcept;
+}
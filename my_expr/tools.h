@@ -63,7 +63,7 @@ inline void json_to_correct_dtype(token_data_t &v_data)
 {
     if (v_data.index() == 2)
     {
-        auto j = std::get<json_t>(v_data);
+        const auto &j = std::get<json_t>(v_data);
         if (json_is_number(j))
         {
             v_data = j.get<num_t>();
@@ -1,5 +1,13 @@
 
 #include "my_expr/my_expr.h"
+#include "my_expr/my_expr_cache.h"
+#include "my_expr/my_expr_parallel.h"
+#include "my_expr/my_expr_projection.h"
+#include <atomic>
+#include <bit>
+#include <filesystem>
+#include <random>
+#include <thread>
 // #include <chrono>
 
 #define assertion(condition, message) \
@@ -8,6 +16,21 @@
         std::exit(1); \
     }
 
+// heap allocations of the whole test, to check the evaluations that must not allocate
+static std::atomic<size_t> heap_allocations{0};
+
+// the replacements are not inlined, GCC would see malloc() and free() paired with new and delete
+__attribute__((noinline)) void *operator new(std::size_t size)
+{
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void *ptr) noexcept { std::free(ptr); }
+__attribute__((noinline)) void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+
 auto fiumba = [](const token_data_t *args) -> token_data_t
 {
     const num_t &arg = std::get<num_t>(args[0]);
@@ -120,5 +143,681 @@ int main()
     std::cout << "Result: " << e8.eval().toString() << std::endl;
     // std::cout << "Result INVALID: " << e7.eval().toString() << std::endl;
 
+    // the register file is reused between evaluations
+    auto e9 = expr("a * b + c");
+    e9.set_variables({{"a", 2}, {"b", 3}, {"c", 4}});
+    e9.compile();
+    assertion(e9.eval().toNumber() == 10, "bytecode first eval");
+    e9.set_variables({{"c", 5}});
+    assertion(e9.eval().toNumber() == 11, "bytecode second eval");
+    assertion(e2.eval().toString() == "hola mundo", "bytecode string eval");
+    assertion(expr::eval("(3 > 2 && 4 % 3 == 1) + !0").toNumber() == 2, "operator opcodes");
+
+    // common sequences are fused into superinstructions
+    assertion(e9.get_program().code.size() == 3 && e9.get_program().code[1].op == opcode::MUL_ADD, "fused a * b + c");
+    auto e9s = expr(R"( "x" + a * b + (a > 1) + s.k + s.l[1] + (c > 4 ? s.k : "no") )");
+    e9s.set_variables({{"a", 2}, {"b", 3}, {"c", 5}, {"s", json_t::parse(R"({"k": "v", "l": [1, 2]})")}});
+    e9s.compile();
+    assertion(e9s.eval().toString() == "x61v2v", "superinstructions on generic values");
+
+    // functions are bound by compile(), undefined ones fail there
+    auto e10 = expr("undefined_fn(1) + 1");
+    auto e10_result = e10.try_compile();
+    assertion(!e10_result && e10_result.error().code == expr_errc::UNDEFINED_FUNCTION, "undefined function fails at compile time");
+    assertion(e8.eval().toString() == "33.952018holafiumba1fiumba1fiumba1fiumba1fiumba1HOLAAA", "bound user function");
+
+    // variables bound to caller owned storage are read on every eval
+    num_t x = 2, y = 3;
+    auto e11 = expr("x * y + len(doc.friends)");
+    e11.bind("x", &x);
+    e11.compile();
+    e11.bind("y", &y);
+    e11.bind("doc", &var);
+    assertion(e11.eval().toNumber() == 14, "bound variables");
+    x = 10;
+    assertion(e11.eval().toNumber() == 38, "bound variables after update");
+
+    // constant folding and numeric rewrites keep the same results
+    num_t z = 4;
+    auto e12 = expr("pow(z, 2) + z ^ 0.5 * 1 + 0 + fac(3) * pi() / pi()");
+    e12.bind("z", &z);
+    e12.compile();
+    assertion(e12.eval().toNumber() == 24, "folded expression");
+    json_t z_json = 9;
+    e12.bind("z", &z_json);
+    assertion(e12.eval().toNumber() == 90, "rebinding a numeric slot recompiles");
+    assertion(expr::eval(R"( "a" + "b" + 0 )").toString() == "ab0", "string folding");
+    for (num_t special : {-0.0, -std::numeric_limits<num_t>::infinity()})
+    {
+        // pow(-0, 0.5) is +0 and pow(-inf, 0.5) is +inf, sqrt() gives -0 and NaN
+        auto special_e = expr("z ^ 0.5 + pow(z, 0.5)");
+        special_e.bind("z", &special);
+        special_e.compile();
+        const num_t result = special_e.eval().toNumber();
+        assertion(result == std::pow(special, 0.5) * 2 && !std::signbit(result), "x ^ 0.5 of " << special << ": " << result);
+    }
+    num_t negative_zero = -0.0;
+    auto zero_e = expr("z + 0");
+    zero_e.bind("z", &negative_zero);
+    zero_e.compile();
+    assertion(!std::signbit(zero_e.eval().toNumber()), "-0 + 0 is +0");
+    auto identities_e = expr("(z - 0) * 1 / 1 ^ 1");
+    identities_e.bind("z", &negative_zero);
+    identities_e.compile();
+    assertion(std::signbit(identities_e.eval().toNumber()) && identities_e.get_program().code.size() == 2, "exact identities are removed");
+
+    // && and || skip the right side, conditionals only evaluate the selected branch
+    int calls = 0;
+    auto e13 = expr("z > 10 && counted(1) || if(z < 5, counted(2), counted(3)) + (z == 4 ? 10 : counted(4))");
+    e13.set_functions({{"counted", {[&calls](const token_data_t *args) -> token_data_t
+                                    { calls++; return args[0]; }, 1}}});
+    e13.bind("z", &z);
+    e13.compile();
+    assertion(e13.eval().toNumber() == 12 && calls == 1, "short-circuit evaluation");
+    z = 20;
+    assertion(e13.eval().toNumber() == 1 && calls == 2, "short-circuit evaluation, other branch");
+    assertion(expr::eval(R"( 1 > 2 ? "a" : 2 > 1 ? "b" : "c" )").toString() == "b", "nested conditional");
+
+    // expressions over numbers bound with bind() run on plain num_t registers
+    num_t p = 3, q = 0.5;
+    auto e14 = expr("p > 2 && q < 1 ? sqrt(p * p + 16) - q % 0.3 : !p");
+    e14.bind("p", &p);
+    e14.bind("q", &q);
+    e14.compile();
+    assertion(std::abs(e14.eval().toNumber() - (5 - std::fmod(0.5, 0.3))) < 1e-12, "numeric program");
+    p = 1;
+    assertion(e14.eval().toNumber() == 0, "numeric program, other branch");
+    string_t q_str = "text";
+    e14.bind("q", &q_str);
+    p = 3;
+    assertion(e14.eval().toNumber() == 0, "generic program after rebinding");
+
+    // native code gives the same results as the interpreter
+    num_t nan = std::numeric_limits<num_t>::quiet_NaN();
+    for (const auto &jit_exp : {"p * q + sin(p) / (q - 1) % 2", "p < q || !(p >= q) && p ^ q", "p == q ? hypot(p, q) : p != q",
+                                "clamp(p, 0, 1) > q && q <= p", "if(p, q, p) - max(p, q)",
+                                "p * q + 1 > p - 2 && p % 3 != q / 2 || q + p * p"})
+    {
+        for (const auto &values : {std::make_pair<num_t, num_t>(3, 0.5), {0, 0}, {nan, 1}, {-2, nan}})
+        {
+            p = values.first;
+            q = values.second;
+            auto interpreted = expr(jit_exp);
+            interpreted.bind("p", &p);
+            interpreted.bind("q", &q);
+            interpreted.compile();
+            auto native = interpreted;
+            if (!native.jit())
+                continue;
+            num_t expected = interpreted.eval().toNumber(), result = native.eval().toNumber();
+            assertion(result == expected || (std::isnan(result) && std::isnan(expected)), "jit result: " << jit_exp);
+        }
+    }
+
+    // one compiled program evaluated from several threads, each with its own context
+    auto e15 = expr("x * 2 + (name == \"b\") + doc.v");
+    e15.compile();
+    auto shared = e15.compiled();
+    std::vector<num_t> shared_results(4);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < 4; t++)
+    {
+        workers.emplace_back([&, t]
+                             {
+            eval_context ctx(shared);
+            num_t x = t;
+            ctx.bind("x", &x);
+            ctx.set_variables({{"name", string_t(t == 1 ? "b" : "a")}, {"doc", json_t::parse(R"({"v": 100})")}});
+            for (int i = 0; i < 1000; i++)
+                shared_results[t] = ctx.eval().toNumber(); });
+    }
+    for (auto &worker : workers)
+        worker.join();
+    assertion(shared_results[0] == 100 && shared_results[1] == 103 && shared_results[3] == 106, "shared compiled program");
+
+    // a context can not change the type a program was optimized for
+    auto e16 = expr("x + 1");
+    e16.bind("x", &p);
+    e16.compile();
+    eval_context ctx16(e16.compiled());
+    bool typed_rebind_throws = false;
+    try
+    {
+        ctx16.bind("x", &q_str);
+    }
+    catch (const std::exception &)
+    {
+        typed_rebind_throws = true;
+    }
+    assertion(typed_rebind_throws, "context rebinding to another type");
+    ctx16.set_variables({{"x", 41}});
+    assertion(ctx16.eval().toNumber() == 42, "context variables in a numeric program");
+
+    // compiled programs are cached by expression text and function registry version
+    expr_cache cache(2, 1);
+    auto cached = cache.get("1 + 2");
+    assertion(cache.get("1 + 2") == cached && cache.hits() == 1 && cache.misses() == 1, "cache hit");
+    cache.get("2 + 3");
+    cache.get("3 + 4");
+    assertion(cache.size() == 2 && cache.evictions() == 1, "cache eviction");
+    cache.get("1 + 2");
+    assertion(cache.misses() == 4, "least recently used entry evicted");
+    cache.set_functions({{"twice", {[](const token_data_t *args) -> token_data_t
+                                    { return std::get<num_t>(args[0]) * 2; }, 1}}});
+    eval_context cached_ctx(cache.get("twice(21)"));
+    assertion(cached_ctx.eval().toNumber() == 42 && cache.get("1 + 2") != cached, "cache function registry version");
+    const uint64_t misses_before = cache.misses();
+    auto bad = cache.try_get("twice(1, 2, 3) +");
+    assertion(!bad && bad.error().code != expr_errc::OK && cache.get("twice(1, 2, 3) +")->program().empty() &&
+                  cache.misses() == misses_before + 1,
+              "cache failed compilation");
+
+    // batch evaluation over columns matches row by row evaluation
+    {
+        const size_t n_rows = 1000;
+        std::vector<num_t> col_a(n_rows), col_b(n_rows), batch_out(n_rows);
+        for (size_t i = 0; i < n_rows; i++)
+        {
+            col_a[i] = static_cast<num_t>(i % 17) - 8;
+            col_b[i] = static_cast<num_t>(i % 5) * 0.5;
+        }
+        num_t row_a = 0, row_b = 0, scale = 3;
+        for (const auto &batch_exp : {"a * b + scale", "a > 0 ? sqrt(a) * b : b - a", "a > 2 && b || a % 3 != 0 && !b", "(a - b) / (scale + 1) < 0.5"})
+        {
+            auto row = expr(batch_exp);
+            row.bind("a", &row_a);
+            row.bind("b", &row_b);
+            row.bind("scale", &scale);
+            row.compile();
+            eval_context batch_ctx(row.compiled());
+            batch_ctx.bind("scale", &scale);
+            batch_ctx.eval_batch({{"a", col_a.data()}, {"b", col_b.data()}}, n_rows, batch_out.data());
+            for (size_t i = 0; i < n_rows; i++)
+            {
+                row_a = col_a[i];
+                row_b = col_b[i];
+                assertion(row.eval().toNumber() == batch_out[i], "batch " << batch_exp << " row " << i);
+            }
+        }
+
+        // strings are evaluated row by row
+        std::vector<string_t> names = {"ab", "c", "def"};
+        std::vector<token_data_t> labels(names.size());
+        eval_batch(expr_cache::global().get("name + \"!\""), {{"name", names.data()}}, names.size(), labels.data());
+        assertion(std::get<string_t>(labels[2]) == "def!", "batch over a string column");
+    }
+
+    // morsels evaluated on a thread pool are written in row order
+    {
+        const size_t n_rows = 100000;
+        std::vector<num_t> col_x(n_rows), serial_out(n_rows), parallel_out(n_rows);
+        for (size_t i = 0; i < n_rows; i++)
+            col_x[i] = static_cast<num_t>(i);
+        num_t offset = 0.25;
+        eval_context pool_ctx(expr_cache::global().get("x > 500 ? sqrt(x) + offset : x * offset"));
+        pool_ctx.bind("offset", &offset);
+        pool_ctx.eval_batch({{"x", col_x.data()}}, n_rows, serial_out.data());
+        batch_executor pool(4, 1024);
+        pool.eval_batch(pool_ctx, {{"x", col_x.data()}}, n_rows, parallel_out.data());
+        assertion(serial_out == parallel_out, "parallel batch matches serial batch");
+
+        // the buffers of a context and of the pool threads are reused by the next batch
+        const columns_t x_column = {{"x", col_x.data()}};
+        batch_executor single(1, 1024);
+        single.eval_batch(pool_ctx, x_column, 2048, parallel_out.data());
+        const size_t before = heap_allocations.load();
+        pool_ctx.eval_batch(x_column, 2048, serial_out.data());
+        single.eval_batch(pool_ctx, x_column, 2048, parallel_out.data());
+        assertion(heap_allocations.load() == before, "allocations in a repeated batch: " << heap_allocations.load() - before);
+        std::weak_ptr<const compiled_expr> released;
+        {
+            auto once_e = expr("x * 3");
+            once_e.compile();
+            released = once_e.compiled();
+            single.eval_batch(once_e.compiled(), x_column, 2048, parallel_out.data());
+        }
+        assertion(released.expired(), "pool threads keep no program after a batch");
+
+        std::vector<string_t> words(n_rows / 10, "w");
+        std::vector<token_data_t> word_out(words.size());
+        pool.eval_batch(expr_cache::global().get("word + \"!\""), {{"word", words.data()}}, words.size(), word_out.data());
+        assertion(std::get<string_t>(word_out.back()) == "w!", "parallel batch over a string column");
+    }
+
+    // builtins computed by the column kernels stay within 2 ULP of the scalar ones (both are below
+    // 1 ULP of the exact result), the exact ones and the scalar fallbacks give the same number
+    {
+        // distance in representable doubles, -0 and +0 are the same number
+        auto ulps = [](num_t a, num_t b) -> uint64_t
+        {
+            auto ordered = [](num_t x)
+            {
+                const auto bits = std::bit_cast<int64_t>(static_cast<double>(x));
+                return bits < 0 ? std::numeric_limits<int64_t>::min() - bits : bits;
+            };
+            const int64_t i = ordered(a), j = ordered(b);
+            return i < j ? static_cast<uint64_t>(j) - static_cast<uint64_t>(i) : static_cast<uint64_t>(i) - static_cast<uint64_t>(j);
+        };
+        // fallbacks: |x| >= 8e5 for sin and cos, subnormals, negatives and zeros for the logarithms,
+        // overflows and underflows for exp and pow
+        std::vector<num_t> col_u = {0, -0.0, 1, -1, 0.5, -3, 2.5e5, 7.99e5, 8e5, -8e5, 9e5, -9e5, 1e6, 1e300, -7e300,
+                                    1e-310, -1e-310, 4e-320, -4e-320, std::numeric_limits<num_t>::denorm_min(), std::numeric_limits<num_t>::min(),
+                                    710, -745, 1e-5, -1e-5, std::numeric_limits<num_t>::infinity(), -std::numeric_limits<num_t>::infinity(), std::nan("")};
+        for (int i = 0; i < 1000; i++)
+            col_u.push_back(std::ldexp(static_cast<num_t>(i % 97) - 48.3, i % 41 - 20));
+        std::vector<num_t> col_v(col_u.rbegin(), col_u.rend()), kernel_out(col_u.size());
+        num_t row_u = 0, row_v = 0;
+        const std::pair<const char *, uint64_t> kernel_exps[] = {
+            {"sin(u)", 2}, {"cos(u)", 2}, {"exp(u)", 2}, {"log(u)", 2}, {"log10(u)", 2}, {"pow(u, v)", 2}, {"u ^ v", 2},
+            {"hypot(u, v)", 2}, {"u > 0 ? log(u) : exp(v)", 2}, {"sqrt(u)", 0}, {"min(u, v)", 0}, {"max(u, v)", 0},
+            {"floor(u)", 0}, {"ceil(u)", 0}, {"trunc(u)", 0}, {"abs(u)", 0}};
+        for (const auto &[kernel_exp, max_ulps] : kernel_exps)
+        {
+            auto row = expr(kernel_exp);
+            row.bind("u", &row_u);
+            row.bind("v", &row_v);
+            row.compile();
+            eval_batch(row.compiled(), {{"u", col_u.data()}, {"v", col_v.data()}}, col_u.size(), kernel_out.data());
+            for (size_t i = 0; i < col_u.size(); i++)
+            {
+                row_u = col_u[i];
+                row_v = col_v[i];
+                const num_t scalar = row.eval().toNumber();
+                const bool same = std::isnan(scalar) ? std::isnan(kernel_out[i]) : !std::isnan(kernel_out[i]) && ulps(scalar, kernel_out[i]) <= max_ulps;
+                assertion(same, "kernel " << kernel_exp << " u " << col_u[i] << " v " << col_v[i] << ": " << kernel_out[i] << " != " << scalar);
+            }
+        }
+    }
+
+    // asynchronous evaluations suspended on lookups that one loop completes later
+    {
+        std::vector<std::pair<string_t, async_result<token_data_t>>> lookups;
+        auto fetch = [&lookups](std::string_view symbol) -> eval_task<token_data_t>
+        {
+            async_result<token_data_t> result;
+            lookups.emplace_back(string_t(symbol), result);
+            co_return co_await result;
+        };
+        auto async_e = expr("score(user) * 2 + (flag ? bonus : 0)");
+        async_e.set_async_var_resolver(fetch);
+        async_e.set_async_functions({{"score", {[&fetch](const token_data_t *args) -> eval_task<token_data_t>
+                                                {
+                                                    token_data_t weight = co_await fetch("weight");
+                                                    co_return std::get<string_t>(args[0]).size() * std::get<num_t>(weight);
+                                                },
+                                                1}}});
+        async_e.compile();
+
+        std::vector<eval_context> in_flight;
+        std::vector<eval_task<parser_dtype>> tasks;
+        for (int i = 0; i < 1000; i++)
+            in_flight.emplace_back(async_e.compiled());
+        for (auto &async_ctx : in_flight)
+        {
+            async_ctx.set_async_var_resolver(fetch);
+            tasks.push_back(async_ctx.eval_async());
+            tasks.back().start();
+        }
+        size_t rounds = 0;
+        while (!lookups.empty())
+        {
+            auto ready = std::move(lookups);
+            lookups.clear();
+            for (auto &lookup : ready)
+            {
+                if (lookup.first == "user")
+                    lookup.second.set_value(string_t("abc"));
+                else if (lookup.first == "flag")
+                    lookup.second.set_value(json_t(true));
+                else
+                    lookup.second.set_value(num_t(lookup.first == "weight" ? 10 : 4));
+            }
+            rounds++;
+        }
+        // user, weight, flag, bonus
+        assertion(rounds == 4, "async lookups awaited one after another: " << rounds);
+        for (auto &task : tasks)
+            assertion(task.done() && task.get().toNumber() == 64, "async eval result");
+
+        bool sync_async_call_throws = false;
+        try
+        {
+            async_e.eval();
+        }
+        catch (const std::exception &)
+        {
+            sync_async_call_throws = true;
+        }
+        assertion(sync_async_call_throws, "asynchronous function called by eval()");
+    }
+
+    // numeric evaluations do not allocate, the register file is sized by compile()
+    {
+        num_t alloc_p = 3, alloc_q = 0.5;
+        auto numeric_e = expr("alloc_p > 2 && alloc_q < 1 ? sqrt(alloc_p * alloc_p + 16) - alloc_q % 0.3 : !alloc_p");
+        numeric_e.bind("alloc_p", &alloc_p);
+        numeric_e.bind("alloc_q", &alloc_q);
+        numeric_e.compile();
+        auto generic_e = expr("if(a > 1, hypot(a, 3), min(a, b)) + (a == 2 || b) * max(max(a, b), 7) - -a ^ 2");
+        generic_e.set_variables({{"a", 2}, {"b", json_t(4.5)}});
+        generic_e.compile();
+        eval_context alloc_ctx(generic_e.compiled());
+        alloc_ctx.set_variables({{"a", 2}, {"b", 4.5}});
+        auto native_e = numeric_e;
+        native_e.jit();
+
+        for (auto *alloc_e : {&numeric_e, &generic_e, &native_e})
+        {
+            const num_t expected = alloc_e->eval().toNumber();
+            const size_t before = heap_allocations.load();
+            bool same = true;
+            for (int i = 0; i < 100; i++)
+                same = same && alloc_e->eval().toNumber() == expected;
+            assertion(same && heap_allocations.load() == before, "allocations in eval: " << heap_allocations.load() - before);
+        }
+        const num_t expected = alloc_ctx.eval().toNumber();
+        const size_t before = heap_allocations.load();
+        assertion(alloc_ctx.eval().toNumber() == expected && heap_allocations.load() == before, "allocations in eval_context::eval");
+    }
+
+    // concatenations are built in the registers, which keep the strings of the previous evaluation
+    {
+        string_t concat_s;
+        num_t concat_n = 0;
+        auto concat_e = expr("s + \"-\" + n + s + (n + s) + split(s, \"b\")[0] + s");
+        concat_e.bind("s", &concat_s);
+        concat_e.bind("n", &concat_n);
+        concat_e.compile();
+        for (const auto &[value, number, expected] : std::vector<std::tuple<string_t, num_t, string_t>>{
+                 {"abcabcabcabcabcabcabc", 2, "abcabcabcabcabcabcabc-2abcabcabcabcabcabcabc2abcabcabcabcabcabcabcaabcabcabcabcabcabcabc"},
+                 {"b", 0.5, "b-0.500000b0.500000bb"},
+                 {"", 7, "-77"}})
+        {
+            concat_s = value;
+            concat_n = number;
+            assertion(concat_e.eval().toString() == expected, "concatenation of " << value);
+        }
+        json_t concat_j = {{"a", 1}, {"b", 2}};
+        auto keys_e = expr("join(keys(j), \",\")");
+        keys_e.bind("j", &concat_j);
+        keys_e.compile();
+        assertion(keys_e.eval().toString() == "a,b", "keys of an object");
+    }
+
+    // errors returned by try_compile() and try_eval() with their code and position
+    {
+        for (const auto &[bad_exp, code, position] : std::vector<std::tuple<string_t, expr_errc, size_t>>{
+                 {"a + \"abc", expr_errc::SYNTAX, 4},
+                 {"a # b", expr_errc::SYNTAX, 2},
+                 {"(a + b", expr_errc::SYNTAX, 6},
+                 {"'foo(' + foo(2)", expr_errc::UNDEFINED_FUNCTION, 9},
+                 {"(max(2))", expr_errc::NOT_ENOUGH_OPERANDS, 1},
+                 {"max(a, b, 7)", expr_errc::SYNTAX, expr_error::no_position},
+                 {"sqrt(2, 3) + 1", expr_errc::SYNTAX, expr_error::no_position}})
+        {
+            auto bad_e = expr(bad_exp);
+            auto compiled = bad_e.try_compile();
+            assertion(!compiled && compiled.error().code == code && compiled.error().position == position,
+                      "try_compile error of " << bad_exp);
+            auto evaluated = bad_e.try_eval();
+            assertion(!evaluated && evaluated.error().code == expr_errc::NOT_COMPILED, "try_eval of " << bad_exp);
+        }
+
+        num_t limit = 3;
+        auto missing_e = expr("limit > 2 || missing * 2");
+        missing_e.bind("limit", &limit);
+        assertion(missing_e.try_compile().has_value(), "try_compile of a valid expression");
+        auto found = missing_e.try_eval();
+        assertion(found && found->toNumber() == 1, "try_eval value");
+        limit = 1;
+        const size_t before = heap_allocations.load();
+        auto missing = missing_e.try_eval();
+        assertion(!missing && missing.error().code == expr_errc::UNDEFINED_VARIABLE && missing.error().symbol == "missing" &&
+                      missing.error().position == 13 && heap_allocations.load() == before,
+                  "try_eval of an undefined variable");
+        bool thrown = false;
+        try
+        {
+            missing_e.eval();
+        }
+        catch (const std::runtime_error &)
+        {
+            thrown = true;
+        }
+        assertion(thrown, "eval of an undefined variable still throws");
+
+        missing_e.unbind("limit");
+        auto unbound = missing_e.try_eval();
+        assertion(!unbound && unbound.error().code == expr_errc::UNDEFINED_VARIABLE && unbound.error().symbol == "limit",
+                  "try_eval of an unbound slot");
+
+        auto failing_e = expr("fail(1)");
+        failing_e.set_functions({{"fail", {[](const token_data_t *) -> token_data_t
+                                           { throw std::runtime_error("failed"); }, 1}}});
+        failing_e.compile();
+        auto failed = failing_e.try_eval();
+        assertion(!failed && failed.error().code == expr_errc::FUNCTION_ERROR && failed.error().message == "failed",
+                  "try_eval of a throwing function");
+    }
+
+    // instructions are 10 bytes, equal literals share one constant register
+    {
+        num_t pool_x = 1;
+        auto pool_e = expr("pool_x / 0 > 0 && pool_x / -0 < 0 && pool_x * 2 + 2 == 4 && pool_x + \"2\" != \"2\"");
+        pool_e.bind("pool_x", &pool_x);
+        pool_e.compile();
+        assertion(sizeof(instruction_t) == 10, "instruction size: " << sizeof(instruction_t));
+        // 0, -0, 2, 4 and "2"
+        assertion(pool_e.get_program().constants.size() == 5, "constant pool: " << pool_e.get_program().constants.size());
+        assertion(pool_e.eval().toNumber() == 1, "shared constants");
+        assertion(pool_e.get_tokens().size() == 25, "postfix tokens: " << pool_e.get_tokens().size());
+    }
+
+    // . and [] chains walk the bound document by reference, only the last element is copied
+    {
+        json_t small_doc = var;
+        json_t big_doc = var;
+        for (int i = 0; i < 1000; i++)
+            big_doc["cars"].push_back(var["cars"][0]);
+        json_t path_doc;
+        num_t path_i = 1;
+        auto path_e = expr("toStr(doc.cars[path_i].models[0]) + toStr(doc.friends[len(doc.cars[0].models) * 2])");
+        path_e.bind("doc", &path_doc);
+        path_e.bind("path_i", &path_i);
+        path_e.compile();
+        size_t allocations[2];
+        for (int size = 0; size < 2; size++)
+        {
+            path_doc = size ? big_doc : small_doc;
+            const size_t before = heap_allocations.load();
+            assertion(path_e.eval().toString() == "\"320\"\"Jenny\"", "json path result");
+            allocations[size] = heap_allocations.load() - before;
+        }
+        assertion(allocations[0] == allocations[1], "json path allocations: " << allocations[0] << ", " << allocations[1]);
+
+        auto missing_path_e = expr("isnan(doc.cars[\"0\"]) + toStr(doc.cars[0].missing) + s[1] + isnan(s.x)");
+        missing_path_e.set_variables({{"doc", var}, {"s", string_t("abc")}});
+        missing_path_e.compile();
+        assertion(missing_path_e.eval().toString() == "1nullb1", "json path without a json: " << missing_path_e.eval().toString());
+
+        // constant keys are walked by one instruction, before and after a dynamic one
+        for (const auto &[path_exp, path_op, result] : std::vector<std::tuple<string_t, opcode, string_t>>{
+                 {"doc.cars[1].models[0]", opcode::PATH_VAR, "\"320\""},
+                 {"doc.cars[5].models[0]", opcode::PATH_VAR, "null"},
+                 {"doc.cars[0].models[path_i]", opcode::PATH_VAR, "\"Focus\""},
+                 {"doc.cars[path_i].models[1]", opcode::PATH, "\"X3\""}})
+        {
+            auto const_path_e = expr(path_exp);
+            const_path_e.bind("doc", &var);
+            const_path_e.bind("path_i", &path_i);
+            const_path_e.compile();
+            const auto &code = const_path_e.get_program().code;
+            assertion(std::any_of(code.begin(), code.end(), [op = path_op](const instruction_t &ins)
+                                  { return ins.op == op; }),
+                      "path instruction in " << path_exp);
+            assertion(const_path_e.eval().toString() == result, "path result of " << path_exp);
+        }
+        auto string_path_e = expr("s[1][0] + isnan(s.a.b)");
+        string_path_e.set_variables({{"s", string_t("abc")}});
+        string_path_e.compile();
+        assertion(string_path_e.eval().toString() == "b1", "constant path over a string");
+    }
+
+    // a shared document is bound to every expression without being copied
+    {
+        json_t big_doc = var;
+        for (int i = 0; i < 1000; i++)
+            big_doc["cars"].push_back(var["cars"][0]);
+        size_t allocations[2];
+        for (int size = 0; size < 2; size++)
+        {
+            shared_json_t doc = std::make_shared<const json_t>(size ? big_doc : var);
+            auto shared_e = expr("toStr(doc.cars[1].models[0]) + doc.friends[1]");
+            shared_e.compile();
+            const size_t before = heap_allocations.load();
+            shared_e.bind("doc", doc);
+            allocations[size] = heap_allocations.load() - before;
+            assertion(shared_e.eval().toString() == "\"320\"Peter", "shared json result: " << shared_e.eval().toString());
+            assertion(doc.use_count() == 2, "shared json held by the expr");
+
+            {
+                auto copy_e = shared_e;
+                eval_context ctx(shared_e.compiled());
+                ctx.bind("doc", doc);
+                assertion(doc.use_count() == 4, "shared json held by the copy and the context");
+                assertion(ctx.eval().toString() == "\"320\"Peter", "shared json result in a context");
+                ctx.unbind("doc");
+                assertion(doc.use_count() == 3, "shared json released by the context");
+            }
+            assertion(doc.use_count() == 2, "shared json released by the copy");
+            shared_e.bind("doc", &var);
+            assertion(doc.use_count() == 1, "shared json released by the expr");
+        }
+        assertion(allocations[0] == allocations[1], "shared json bind allocations: " << allocations[0] << ", " << allocations[1]);
+    }
+
+    // only the values the rules read are parsed from the text of a document
+    {
+        json_t full_doc = {{"doc", var}, {"limit", 4}, {"unused", json_t::array()}};
+        for (int i = 0; i < 100; i++)
+        {
+            full_doc["doc"]["cars"].push_back(var["cars"][0]);
+            full_doc["unused"].push_back(var);
+        }
+        // the name of a member can be escaped
+        string_t text = full_doc.dump(2);
+        text.replace(text.find("\"limit\""), 7, "\"li\\u006dit\"");
+
+        std::vector<expr> rules{expr("toStr(doc.cars[1].models[0]) + toStr(limit)"),
+                                expr("doc.friends[len(doc.cars[0].models) * 2]"),
+                                expr("doc.name + toStr(doc.age * 2)")};
+        std::vector<compiled_expr_ptr> compiled;
+        for (auto &rule : rules)
+        {
+            rule.compile();
+            compiled.push_back(rule.compiled());
+        }
+        json_projection projection(compiled);
+
+        const auto projected = projection.parse(text);
+        assertion(!projected.contains("unused"), "unread member skipped");
+        assertion(projected["doc"]["cars"].size() == 2 && projected["doc"]["cars"][0].is_object() &&
+                      !projected["doc"]["cars"][0].contains("name") && projected["doc"]["cars"][1]["models"] == json_t({"320"}),
+                  "only the elements that are read: " << projected["doc"]["cars"].dump());
+        assertion(projected["doc"]["friends"] == var["friends"], "member read with a dynamic key parsed whole");
+        assertion(projected["limit"] == 4, "escaped member name");
+
+        const auto variables = projection.parse_variables(text);
+        for (size_t i = 0; i < rules.size(); i++)
+        {
+            eval_context full_ctx(compiled[i]), projected_ctx(compiled[i]);
+            full_ctx.set_variables(convert_to_variant_map(full_doc));
+            projected_ctx.set_variables(variables);
+            assertion(projected_ctx.eval().toString() == full_ctx.eval().toString(),
+                      "projected result of " << compiled[i]->expression() << ": " << projected_ctx.eval().toString());
+        }
+
+        bool invalid = false;
+        try
+        {
+            projection.parse(text.substr(0, text.size() / 2));
+        }
+        catch (const std::exception &)
+        {
+            invalid = true;
+        }
+        assertion(invalid, "truncated document");
+    }
+
+    // variables, functions and json paths of a compiled expression
+    {
+        auto deps_e = expr("if(limit > 2, toStr(sqrt(doc.cars[i].models[0])), fiumba(doc.name)) + len(items) + doc.friends[1] + doc.cars[0].name");
+        deps_e.set_functions({{"fiumba", {fiumba, 1}}});
+        deps_e.compile();
+        const auto deps = deps_e.compiled()->dependencies();
+        auto sorted = [](std::vector<string_t> names)
+        {
+            std::sort(names.begin(), names.end());
+            return names;
+        };
+        assertion(sorted(deps.variables) == std::vector<string_t>({"doc", "i", "items", "limit"}), "dependency variables");
+        assertion(sorted(deps.builtin_functions) == std::vector<string_t>({"len", "sqrt", "toStr"}), "dependency builtins");
+        assertion(deps.user_functions == std::vector<string_t>({"fiumba"}), "dependency user functions");
+        std::vector<string_t> paths, dynamic_paths;
+        for (const auto &path : deps.paths)
+            (path.dynamic ? dynamic_paths : paths).push_back(path.to_string());
+        assertion(sorted(paths) == std::vector<string_t>({"doc.cars[0].name", "doc.friends[1]", "doc.name", "i", "items", "limit"}), "dependency paths");
+        assertion(dynamic_paths == std::vector<string_t>({"doc.cars"}) && deps.dynamic_access, "dependency dynamic paths");
+
+        auto static_e = expr("a.b[2] * 2 + 1");
+        static_e.compile();
+        const auto static_deps = static_e.compiled()->dependencies();
+        assertion(!static_deps.dynamic_access && static_deps.paths.size() == 1 && static_deps.paths[0].keys == std::vector<token_data_t>({string_t("b"), 2.0}),
+                  "dependency without dynamic access");
+
+        auto index_e = expr("a[2.7] + a[0 - 1] + a[10000000000]");
+        index_e.compile();
+        std::vector<string_t> index_paths;
+        for (const auto &path : index_e.compiled()->dependencies().paths)
+            index_paths.push_back(path.to_string());
+        assertion(sorted(index_paths) == std::vector<string_t>({"a[-1]", "a[1e+10]", "a[2]"}), "dependency paths with indexes out of range");
+    }
+
+    // rule sets built ahead of time into a shared object
+    p = 3;
+    q = 0.5;
+    std::vector<expr> rules;
+    for (const auto &aot_exp : {"p * q + sin(p) / (q - 1) % 2", "fmod(p, q) + fac(p) - cot(q)", "p > q ? p / 0 : -q / 0"})
+    {
+        rules.emplace_back(aot_exp);
+        rules.back().bind("p", &p);
+        rules.back().bind("q", &q);
+        rules.back().compile();
+    }
+    std::vector<expr *> rule_ptrs;
+    std::vector<num_t> expected;
+    for (auto &rule : rules)
+    {
+        expected.push_back(rule.eval().toNumber());
+        rule_ptrs.push_back(&rule);
+    }
+    // nothing is built into or loaded from a directory others can write to
+    {
+        const auto shared_dir = std::filesystem::temp_directory_path() / ("my_expr_aot_shared_" + std::to_string(std::random_device()()));
+        std::filesystem::create_directories(shared_dir);
+        std::filesystem::permissions(shared_dir, std::filesystem::perms::all);
+        assertion(aot_compiler(shared_dir.string()).build(rule_ptrs) == 0 && !rules[0].is_native(), "aot cache writable by others");
+        std::filesystem::remove_all(shared_dir);
+    }
+    // skipped when there is no compiler to build the rules with
+    aot_compiler aot;
+    if (aot.build(rule_ptrs) == rules.size())
+    {
+        for (size_t i = 0; i < rules.size(); i++)
+            assertion(rules[i].is_native() && rules[i].eval().toNumber() == expected[i], "aot result: " << i);
+        const auto cache_perms = std::filesystem::status(aot.cache_dir()).permissions();
+        assertion((cache_perms & (std::filesystem::perms::group_all | std::filesystem::perms::others_all)) == std::filesystem::perms::none, "private aot cache");
+    }
+
     return 0;
 }
\ No newline at end of file